@@ -15,6 +15,8 @@
 #include <sound/pcm_params.h>
 #include <linux/gpio/consumer.h>
 #include <linux/clk.h>
+#include <linux/workqueue.h>
+#include <linux/uaccess.h>
 
 /* External module: include config */
 #include <generated/autoconf.h>
@@ -23,137 +25,681 @@ static int dai_format = SND_SOC_DAIFMT_BP_FP | SND_SOC_DAIFMT_NB_NF | SND_SOC_DA
 
 static int blr_ratio = 64;
 
+#define BOTIC_BLR_MAX		512
+
+/*
+ * A control of every codec written at once: with several DACs on the link,
+ * the card exposes the unprefixed control and forwards writes to all of
+ * them from parallel workers, so each chip's I2C transfer does not wait for
+ * the previous one.
+ */
+struct botic_fanout {
+	struct work_struct work;
+	struct snd_kcontrol *kctl;
+	struct snd_ctl_elem_value *ucontrol;
+	int ret;
+};
+
+#define BOTIC_NUM_RATES		18
+/* The leading rates PCM may use, up to 768000 */
+#define BOTIC_NUM_PCM_RATES	16
+
+/* Oscillator and BCLK divider for one rate, div 0 if not possible */
+struct botic_clkdiv {
+	unsigned long sysclk;
+	unsigned int div;
+};
+
+static const char * const botic_fanout_ctls[] = {
+	"Master Playback Volume",
+	"Master Playback Switch",
+};
+
 struct botic_priv {
 	unsigned long clk44_freq;
 	unsigned long clk48_freq;
 	struct clk *mux, *clk44, *clk48;
 	struct gpio_desc *power_switch;
 	struct gpio_desc *dsd_switch;
+
+	/*
+	 * Configuration last applied by botic_hw_params(), so that a new
+	 * stream with the same parameters does not touch the clocks or
+	 * the codec. Zero (or -1 for the dividers) means unknown.
+	 */
+	unsigned int cur_fmt;
+	unsigned int cur_sysclk;
+	int cur_dsd;
+	int cur_blr_div;
+	int cur_bclk_div;
+
+	/*
+	 * Rates the oscillators can clock exactly, per DSD/PCM and sample
+	 * width in bytes - 1, as bits in botic_rates, and the oscillator and
+	 * BCLK divider for each. Built for BCLK/LRCLK ratio rates_blr.
+	 */
+	unsigned int pcm_rates[4];
+	unsigned int dsd_rates[4];
+	struct botic_clkdiv pcm_div[4][BOTIC_NUM_RATES];
+	struct botic_clkdiv dsd_div[4][BOTIC_NUM_RATES];
+	int rates_blr;
+
+	/*
+	 * Per card configuration, from DT with the module parameters as
+	 * defaults, changeable at runtime through the card controls.
+	 */
+	int blr_ratio;
+	unsigned int dai_format;
+
+	/* Codecs of the link, in channel order */
+	int num_codecs;
+	struct snd_soc_component **codecs;
+	struct botic_fanout *fanout;
+
+	struct snd_soc_card card;
+	struct snd_soc_dai_link dai_link;
+	struct snd_soc_dai_link_component cpus, platforms;
+};
+
+static void botic_invalidate_config(struct botic_priv *priv) {
+	priv->cur_fmt = 0;
+	priv->cur_sysclk = 0;
+	priv->cur_dsd = -1;
+	priv->cur_blr_div = -1;
+	priv->cur_bclk_div = -1;
+}
+
+/*
+ * The last two are DSD only: DSD256 as DSD_U8, DSD512 as DSD_U16 or
+ * DSD1024 as DSD_U32 frames, the latter with BCLK at the oscillator
+ * itself. botic_build_rates() never offers them for PCM.
+ */
+static const unsigned int botic_rates[BOTIC_NUM_RATES] = {
+	8000, 11025, 16000, 22050, 32000, 44100, 48000, 64000,
+	88200, 96000, 176400, 192000, 352800, 384000, 705600, 768000,
+	1411200, 1536000,
 };
 
+static bool botic_format_is_dsd(snd_pcm_format_t format)
+{
+	switch (format) {
+	case SNDRV_PCM_FORMAT_DSD_U8:
+	case SNDRV_PCM_FORMAT_DSD_U16_LE:
+	case SNDRV_PCM_FORMAT_DSD_U32_LE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* BCLK must divide one of the oscillators exactly */
+static void botic_clkdiv_calc(struct botic_priv *priv, unsigned int bclk,
+		struct botic_clkdiv *cd)
+{
+	if (priv->clk44_freq % bclk == 0) {
+		cd->sysclk = priv->clk44_freq;
+		cd->div = priv->clk44_freq / bclk;
+	} else if (priv->clk48_freq % bclk == 0) {
+		cd->sysclk = priv->clk48_freq;
+		cd->div = priv->clk48_freq / bclk;
+	} else {
+		cd->sysclk = 0;
+		cd->div = 0;
+	}
+}
+
+/*
+ * Same BCLK choice as botic_hw_params(), for every rate and sample width;
+ * without a fixed BCLK/LRCLK ratio a PCM frame is two slots per
+ * serializer, for any number of channels.
+ */
+static void botic_build_rates(struct botic_priv *priv)
+{
+	unsigned int rate, width;
+	int i, w;
+
+	for (w = 0; w < ARRAY_SIZE(priv->pcm_rates); w++) {
+		width = 8 * (w + 1);
+		priv->pcm_rates[w] = 0;
+		priv->dsd_rates[w] = 0;
+
+		for (i = 0; i < BOTIC_NUM_RATES; i++) {
+			rate = botic_rates[i];
+			if (i < BOTIC_NUM_PCM_RATES)
+				botic_clkdiv_calc(priv, (priv->blr_ratio ? priv->blr_ratio : 2 * width) * rate,
+						  &priv->pcm_div[w][i]);
+			else
+				priv->pcm_div[w][i] = (struct botic_clkdiv){ 0 };
+			if (priv->pcm_div[w][i].div)
+				priv->pcm_rates[w] |= BIT(i);
+			botic_clkdiv_calc(priv, width * rate, &priv->dsd_div[w][i]);
+			if (priv->dsd_div[w][i].div)
+				priv->dsd_rates[w] |= BIT(i);
+		}
+	}
+
+	priv->rates_blr = priv->blr_ratio;
+}
+
+static unsigned int botic_format_rates(struct botic_priv *priv,
+		snd_pcm_format_t format)
+{
+	int w = snd_pcm_format_width(format) / 8 - 1;
+
+	if (w < 0 || w >= ARRAY_SIZE(priv->pcm_rates))
+		return 0;
+
+	return botic_format_is_dsd(format) ? priv->dsd_rates[w] : priv->pcm_rates[w];
+}
+
+static int botic_rate_index(unsigned int rate)
+{
+	int i;
+
+	for (i = 0; i < BOTIC_NUM_RATES; i++)
+		if (botic_rates[i] == rate)
+			return i;
+
+	return -1;
+}
+
 static int botic_hw_params(struct snd_pcm_substream *substream,
 		struct snd_pcm_hw_params *params) {
 	
 	struct snd_soc_pcm_runtime *rtd = snd_soc_substream_to_rtd(substream);
-	struct snd_soc_dai *codec_dai = snd_soc_rtd_to_codec(rtd, 0);
+	struct snd_soc_dai *codec_dai;
 	struct snd_soc_dai *cpu_dai = snd_soc_rtd_to_cpu(rtd, 0);
 	struct botic_priv *priv = snd_soc_card_get_drvdata(rtd->card);
 	unsigned int sysclk, bclk, divisor;
-	int ret;
+	struct botic_clkdiv cd;
+	int dsd, blr_div;
+	int i, w, idx, ret;
 	
 	unsigned int rate = params_rate(params);
 
-	/* set codec DAI configuration */
-	ret = snd_soc_dai_set_fmt(codec_dai, dai_format);
-	if ((ret < 0) && (ret != -ENOTSUPP))
-		return ret;
-	
-	/* set cpu DAI configuration */
-	ret = snd_soc_dai_set_fmt(cpu_dai, dai_format);
-	if (ret < 0)
-		return ret;
-
-	/* select correct clock for requested sample rate */
-	if (priv->clk44_freq % rate == 0) {
-		sysclk = priv->clk44_freq;
-		clk_set_parent(priv->mux, priv->clk44);
-	} else if (priv->clk48_freq % rate == 0) {
-		sysclk = priv->clk48_freq;
-		clk_set_parent(priv->mux, priv->clk48);
-	} else {
-		printk("unsupported rate %d\n", rate);
-		return -EINVAL;
-	}
-
-	/* set the codec system clock */
-	ret = snd_soc_dai_set_sysclk(codec_dai, 0, sysclk, SND_SOC_CLOCK_IN);
-	if ((ret < 0) && (ret != -ENOTSUPP))
-		return ret;
-
-	/* use the external clock */
-	ret = snd_soc_dai_set_sysclk(cpu_dai, 0, sysclk, SND_SOC_CLOCK_IN);
-	if (ret < 0) {
-		printk(KERN_WARNING "botic-card: unable to set clock to CPU; ret=%d", ret);
-		return ret;
-	}
-
 	switch (params_format(params)) {
 		case SNDRV_PCM_FORMAT_DSD_U8:
-			/* Enable DSD switch */
-			gpiod_set_value(priv->dsd_switch, 1);
-			/* Clock rate for DSD matches bitrate */
-			ret = snd_soc_dai_set_clkdiv(cpu_dai, 2, 0);
-			bclk = 8 * rate;
-			break;
-		
 		case SNDRV_PCM_FORMAT_DSD_U16_LE:
-			gpiod_set_value(priv->dsd_switch, 1);
-			/* Clock rate for DSD matches bitrate */
-			ret = snd_soc_dai_set_clkdiv(cpu_dai, 2, 0);
-			bclk = 16 * rate;
-			break;
-
 		case SNDRV_PCM_FORMAT_DSD_U32_LE:
-			gpiod_set_value(priv->dsd_switch, 1);
+			dsd = 1;
 			/* Clock rate for DSD matches bitrate */
-			ret = snd_soc_dai_set_clkdiv(cpu_dai, 2, 0);
-			bclk = 32 * rate;
+			blr_div = 0;
+			bclk = params_width(params) * rate;
 			break;
 
 		default:
-			/* Disable DSD switch */
-			gpiod_set_value(priv->dsd_switch, 0);
 			/* PCM */
-			ret = snd_soc_dai_set_clkdiv(cpu_dai, 2, blr_ratio);
-			if (blr_ratio != 0) {
-				bclk = blr_ratio * rate;
+			dsd = 0;
+			blr_div = priv->blr_ratio;
+			/* Two slots per serializer, whatever the channel count */
+			if (priv->blr_ratio != 0) {
+				bclk = priv->blr_ratio * rate;
 			} else {
-				bclk = snd_soc_params_to_bclk(params);
+				bclk = 2 * params_width(params) * rate;
 			}
 			break;
 	}
-	if (ret < 0) {
-		printk(KERN_WARNING "botic-card: unsupported BCLK/LRCLK ratio");
-		return ret;
+	/*
+	 * Select the oscillator BCLK divides, the hw rules ensure there is
+	 * one. The table covers the standard rates.
+	 */
+	w = params_width(params) / 8 - 1;
+	idx = botic_rate_index(rate);
+	if (idx >= 0 && w >= 0 && w < ARRAY_SIZE(priv->pcm_div) &&
+	    priv->rates_blr == priv->blr_ratio) {
+		cd = dsd ? priv->dsd_div[w][idx] : priv->pcm_div[w][idx];
+	} else {
+		botic_clkdiv_calc(priv, bclk, &cd);
 	}
-	
-	divisor = sysclk / bclk;
-	ret = snd_soc_dai_set_clkdiv(cpu_dai, 1, divisor);
-	if (ret < 0) {
-		printk(KERN_WARNING "botic-card: unsupported set_clkdiv1");
-		return ret;
+
+	if (!cd.div) {
+		printk("unsupported rate %d\n", rate);
+		return -EINVAL;
+	}
+
+	sysclk = cd.sysclk;
+	divisor = cd.div;
+
+	if (priv->cur_fmt != priv->dai_format) {
+		/* set codec DAI configuration */
+		for_each_rtd_codec_dais(rtd, i, codec_dai) {
+			ret = snd_soc_dai_set_fmt(codec_dai, priv->dai_format);
+			if ((ret < 0) && (ret != -ENOTSUPP))
+				goto err;
+		}
+
+		/* set cpu DAI configuration */
+		ret = snd_soc_dai_set_fmt(cpu_dai, priv->dai_format);
+		if (ret < 0)
+			goto err;
+
+		priv->cur_fmt = priv->dai_format;
+	}
+
+	if (priv->cur_sysclk != sysclk) {
+		clk_set_parent(priv->mux, sysclk == priv->clk44_freq ?
+				priv->clk44 : priv->clk48);
+
+		/* set the codec system clock */
+		for_each_rtd_codec_dais(rtd, i, codec_dai) {
+			ret = snd_soc_dai_set_sysclk(codec_dai, 0, sysclk, SND_SOC_CLOCK_IN);
+			if ((ret < 0) && (ret != -ENOTSUPP))
+				goto err;
+		}
+
+		/*
+		 * use the external clock; a McASP clocked from a linked
+		 * leader has no clocks of its own to set up
+		 */
+		ret = snd_soc_dai_set_sysclk(cpu_dai, 0, sysclk, SND_SOC_CLOCK_IN);
+		if ((ret < 0) && (ret != -ENOTSUPP)) {
+			printk(KERN_WARNING "botic-card: unable to set clock to CPU; ret=%d", ret);
+			goto err;
+		}
+
+		priv->cur_sysclk = sysclk;
+	}
+
+	if (priv->cur_dsd != dsd) {
+		/* Enable DSD switch for DSD, disable it for PCM */
+		gpiod_set_value(priv->dsd_switch, dsd);
+		priv->cur_dsd = dsd;
+	}
+
+	if (priv->cur_blr_div != blr_div) {
+		ret = snd_soc_dai_set_clkdiv(cpu_dai, 2, blr_div);
+		if ((ret < 0) && (ret != -ENOTSUPP)) {
+			printk(KERN_WARNING "botic-card: unsupported BCLK/LRCLK ratio");
+			goto err;
+		}
+		priv->cur_blr_div = blr_div;
+	}
+
+	if (priv->cur_bclk_div != divisor) {
+		ret = snd_soc_dai_set_clkdiv(cpu_dai, 1, divisor);
+		if ((ret < 0) && (ret != -ENOTSUPP)) {
+			printk(KERN_WARNING "botic-card: unsupported set_clkdiv1");
+			goto err;
+		}
+		priv->cur_bclk_div = divisor;
 	}
 
 	return 0;
+
+err:
+	/* Partially applied, start from scratch next time */
+	botic_invalidate_config(priv);
+	return ret;
+}
+
+static int botic_hw_rule_rate(struct snd_pcm_hw_params *params,
+		struct snd_pcm_hw_rule *rule)
+{
+	struct botic_priv *priv = rule->private;
+	struct snd_mask *fmt = hw_param_mask(params, SNDRV_PCM_HW_PARAM_FORMAT);
+	snd_pcm_format_t format;
+	unsigned int rates = 0;
+
+	pcm_for_each_format(format) {
+		if (snd_mask_test_format(fmt, format))
+			rates |= botic_format_rates(priv, format);
+	}
+
+	return snd_interval_list(hw_param_interval(params, SNDRV_PCM_HW_PARAM_RATE),
+				 BOTIC_NUM_RATES, botic_rates, rates);
+}
+
+static int botic_hw_rule_format(struct snd_pcm_hw_params *params,
+		struct snd_pcm_hw_rule *rule)
+{
+	struct botic_priv *priv = rule->private;
+	struct snd_interval *ri = hw_param_interval(params, SNDRV_PCM_HW_PARAM_RATE);
+	struct snd_mask *fmt = hw_param_mask(params, SNDRV_PCM_HW_PARAM_FORMAT);
+	struct snd_mask nfmt;
+	snd_pcm_format_t format;
+	unsigned int rates;
+	int i;
+
+	snd_mask_none(&nfmt);
+	pcm_for_each_format(format) {
+		if (!snd_mask_test_format(fmt, format))
+			continue;
+
+		rates = botic_format_rates(priv, format);
+		for (i = 0; i < BOTIC_NUM_RATES; i++) {
+			if ((rates & BIT(i)) && snd_interval_test(ri, botic_rates[i])) {
+				snd_mask_set_format(&nfmt, format);
+				break;
+			}
+		}
+	}
+
+	return snd_mask_refine(fmt, &nfmt);
+}
+
+/*
+ * Only offer rates the oscillators can produce, so that players see the
+ * real rate list when refining instead of a failing hw_params.
+ */
+static int botic_startup(struct snd_pcm_substream *substream)
+{
+	struct snd_soc_pcm_runtime *rtd = snd_soc_substream_to_rtd(substream);
+	struct botic_priv *priv = snd_soc_card_get_drvdata(rtd->card);
+	int ret;
+
+	/* "BCLK Ratio" is writeable at runtime */
+	if (priv->rates_blr != priv->blr_ratio)
+		botic_build_rates(priv);
+
+	ret = snd_pcm_hw_rule_add(substream->runtime, 0, SNDRV_PCM_HW_PARAM_RATE,
+				  botic_hw_rule_rate, priv,
+				  SNDRV_PCM_HW_PARAM_FORMAT, -1);
+	if (ret)
+		return ret;
+
+	return snd_pcm_hw_rule_add(substream->runtime, 0, SNDRV_PCM_HW_PARAM_FORMAT,
+				   botic_hw_rule_format, priv,
+				   SNDRV_PCM_HW_PARAM_RATE, -1);
 }
 
 static struct snd_soc_ops botic_ops = {
+	.startup = botic_startup,
 	.hw_params = botic_hw_params,
 };
 
-static struct snd_soc_dai_link_component botic_cpus,
-					 botic_codecs,
-					 botic_platforms;
-
-static struct snd_soc_dai_link botic_dai = {
-	.name = "Botic",
-	.stream_name = "external",
-	.cpus = &botic_cpus,
-	.num_cpus = 1,
-	.codecs = &botic_codecs,
-	.num_codecs = 1,
-	.platforms = &botic_platforms,
-	.num_platforms = 1,
-	.ops = &botic_ops,
+static void botic_fanout_work(struct work_struct *work)
+{
+	struct botic_fanout *f = container_of(work, struct botic_fanout, work);
+
+	f->ret = f->kctl->put(f->kctl, f->ucontrol);
+}
+
+/* The first codec stands for all of them when reading */
+static struct snd_kcontrol *botic_fanout_first(struct snd_kcontrol *kcontrol)
+{
+	struct snd_soc_card *card = snd_kcontrol_chip(kcontrol);
+	struct botic_priv *priv = snd_soc_card_get_drvdata(card);
+
+	return snd_soc_component_get_kcontrol(priv->codecs[0],
+			botic_fanout_ctls[kcontrol->private_value]);
+}
+
+static int botic_fanout_info(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_info *uinfo)
+{
+	struct snd_kcontrol *kctl = botic_fanout_first(kcontrol);
+
+	if (!kctl)
+		return -ENODEV;
+	return kctl->info(kctl, uinfo);
+}
+
+static int botic_fanout_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_kcontrol *kctl = botic_fanout_first(kcontrol);
+
+	if (!kctl)
+		return -ENODEV;
+	return kctl->get(kctl, ucontrol);
+}
+
+/* The dB scale of the codec controls, so the card control has one too */
+static int botic_fanout_tlv(struct snd_kcontrol *kcontrol, int op_flag,
+		unsigned int size, unsigned int __user *tlv)
+{
+	struct snd_kcontrol *kctl = botic_fanout_first(kcontrol);
+	unsigned int len;
+
+	if (!kctl)
+		return -ENODEV;
+
+	if (kctl->vd[0].access & SNDRV_CTL_ELEM_ACCESS_TLV_CALLBACK)
+		return kctl->tlv.c(kctl, op_flag, size, tlv);
+
+	if (op_flag != SNDRV_CTL_TLV_OP_READ || !kctl->tlv.p)
+		return -ENXIO;
+
+	len = kctl->tlv.p[SNDRV_CTL_TLVO_LEN] + 2 * sizeof(unsigned int);
+	if (size < len)
+		return -ENOMEM;
+	if (copy_to_user(tlv, kctl->tlv.p, len))
+		return -EFAULT;
+
+	return 0;
+}
+
+static int botic_fanout_put(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_card *card = snd_kcontrol_chip(kcontrol);
+	struct botic_priv *priv = snd_soc_card_get_drvdata(card);
+	const char *name = botic_fanout_ctls[kcontrol->private_value];
+	struct botic_fanout *f;
+	int i, ret = 0, changed = 0;
+
+	for (i = 0; i < priv->num_codecs; i++) {
+		f = &priv->fanout[i];
+		f->kctl = snd_soc_component_get_kcontrol(priv->codecs[i], name);
+		if (!f->kctl)
+			continue;
+		f->ucontrol = ucontrol;
+		queue_work(system_unbound_wq, &f->work);
+	}
+
+	for (i = 0; i < priv->num_codecs; i++) {
+		f = &priv->fanout[i];
+		if (!f->kctl)
+			continue;
+		flush_work(&f->work);
+		if (f->ret < 0) {
+			ret = f->ret;
+		} else if (f->ret > 0) {
+			changed = 1;
+			snd_ctl_notify(card->snd_card, SNDRV_CTL_EVENT_MASK_VALUE,
+				       &f->kctl->id);
+		}
+	}
+
+	return ret ? ret : changed;
+}
+
+/*
+ * Give every codec the channels of its serializer and, with more than
+ * one codec, add the controls writing to all of them.
+ */
+static int botic_late_probe(struct snd_soc_card *card)
+{
+	struct botic_priv *priv = snd_soc_card_get_drvdata(card);
+	struct snd_soc_pcm_runtime *rtd = snd_soc_get_pcm_runtime(card, card->dai_link);
+	struct snd_soc_dai_link_ch_map *ch_map;
+	struct snd_soc_dai *codec_dai;
+	struct snd_kcontrol_new ctl = {
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.info = botic_fanout_info,
+		.get = botic_fanout_get,
+		.put = botic_fanout_put,
+	};
+	int i, ret;
+
+	if (priv->num_codecs == 1)
+		return 0;
+
+	for_each_rtd_codec_dais(rtd, i, codec_dai) {
+		priv->codecs[i] = codec_dai->component;
+		INIT_WORK(&priv->fanout[i].work, botic_fanout_work);
+
+		ch_map = &card->dai_link->ch_maps[i];
+		ret = snd_soc_dai_set_tdm_slot(codec_dai, ch_map->ch_mask, 0,
+					       fls(ch_map->ch_mask), 0);
+		if (ret < 0 && ret != -ENOTSUPP)
+			return ret;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(botic_fanout_ctls); i++) {
+		struct snd_kcontrol *kctl;
+
+		kctl = snd_soc_component_get_kcontrol(priv->codecs[0],
+						      botic_fanout_ctls[i]);
+		if (!kctl)
+			continue;
+
+		ctl.access = SNDRV_CTL_ELEM_ACCESS_READWRITE;
+		ctl.tlv.c = NULL;
+		if (kctl->vd[0].access & SNDRV_CTL_ELEM_ACCESS_TLV_READ) {
+			ctl.access |= SNDRV_CTL_ELEM_ACCESS_TLV_READ |
+				      SNDRV_CTL_ELEM_ACCESS_TLV_CALLBACK;
+			ctl.tlv.c = botic_fanout_tlv;
+		}
+
+		ctl.name = botic_fanout_ctls[i];
+		ctl.private_value = i;
+		ret = snd_soc_add_card_controls(card, &ctl, 1);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static const char * const botic_format_texts[] = {
+	"I2S", "Left Justified", "Right Justified",
 };
 
-static struct snd_soc_card botic_card = {
-	.name = "Botic",
-	.owner = THIS_MODULE,
-	.dai_link = &botic_dai,
-	.num_links = 1,
+static const unsigned int botic_format_values[] = {
+	SND_SOC_DAIFMT_I2S, SND_SOC_DAIFMT_LEFT_J, SND_SOC_DAIFMT_RIGHT_J,
 };
 
+static SOC_ENUM_SINGLE_EXT_DECL(botic_format_enum, botic_format_texts);
+
+static int botic_format_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_card *card = snd_kcontrol_chip(kcontrol);
+	struct botic_priv *priv = snd_soc_card_get_drvdata(card);
+	unsigned int format = priv->dai_format & SND_SOC_DAIFMT_FORMAT_MASK;
+	int i;
+
+	ucontrol->value.enumerated.item[0] = 0;
+	for (i = 0; i < ARRAY_SIZE(botic_format_values); i++)
+		if (botic_format_values[i] == format)
+			ucontrol->value.enumerated.item[0] = i;
+	return 0;
+}
+
+/* Both take effect with the next hw_params */
+static int botic_format_put(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_card *card = snd_kcontrol_chip(kcontrol);
+	struct botic_priv *priv = snd_soc_card_get_drvdata(card);
+	unsigned int item = ucontrol->value.enumerated.item[0];
+	unsigned int format;
+
+	if (item >= ARRAY_SIZE(botic_format_values))
+		return -EINVAL;
+
+	format = (priv->dai_format & ~SND_SOC_DAIFMT_FORMAT_MASK) |
+		 botic_format_values[item];
+	if (format == priv->dai_format)
+		return 0;
+
+	priv->dai_format = format;
+	return 1;
+}
+
+/* Even ratios only, both slots of a frame are the same width */
+static int botic_blr_info(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = BOTIC_BLR_MAX;
+	uinfo->value.integer.step = 2;
+	return 0;
+}
+
+static int botic_blr_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_card *card = snd_kcontrol_chip(kcontrol);
+	struct botic_priv *priv = snd_soc_card_get_drvdata(card);
+
+	ucontrol->value.integer.value[0] = priv->blr_ratio;
+	return 0;
+}
+
+static int botic_blr_put(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_card *card = snd_kcontrol_chip(kcontrol);
+	struct botic_priv *priv = snd_soc_card_get_drvdata(card);
+	long val = ucontrol->value.integer.value[0];
+
+	/* 0 derives the ratio from the stream */
+	if (val < 0 || val > BOTIC_BLR_MAX || (val & 1))
+		return -EINVAL;
+
+	if (val == priv->blr_ratio)
+		return 0;
+
+	priv->blr_ratio = val;
+	return 1;
+}
+
+static const struct snd_kcontrol_new botic_card_controls[] = {
+	SOC_ENUM_EXT("DAI Format", botic_format_enum,
+		     botic_format_get, botic_format_put),
+	{
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "BCLK Ratio",
+		.info = botic_blr_info,
+		.get = botic_blr_get,
+		.put = botic_blr_put,
+	},
+};
+
+/*
+ * Card configuration from DT, falling back to the module parameters:
+ * botic,blr-ratio (BCLK/LRCLK ratio, 0 for automatic) and
+ * botic,dai-format ("i2s", "left_j" or "right_j").
+ */
+static int botic_parse_config(struct device *dev, struct botic_priv *priv)
+{
+	struct device_node *np = dev->of_node;
+	const char *format;
+	u32 val;
+	int i;
+
+	priv->blr_ratio = blr_ratio;
+	if (!of_property_read_u32(np, "botic,blr-ratio", &val))
+		priv->blr_ratio = val;
+	if (priv->blr_ratio < 0 || priv->blr_ratio > BOTIC_BLR_MAX ||
+	    (priv->blr_ratio & 1)) {
+		dev_err(dev, "invalid BCLK/LRCLK ratio %d\n", priv->blr_ratio);
+		return -EINVAL;
+	}
+
+	priv->dai_format = dai_format;
+	if (!of_property_read_string(np, "botic,dai-format", &format)) {
+		static const char * const names[] = { "i2s", "left_j", "right_j" };
+
+		for (i = 0; i < ARRAY_SIZE(names); i++)
+			if (!strcmp(format, names[i]))
+				break;
+		if (i == ARRAY_SIZE(names)) {
+			dev_err(dev, "invalid DAI format %s\n", format);
+			return -EINVAL;
+		}
+
+		priv->dai_format = (priv->dai_format & ~SND_SOC_DAIFMT_FORMAT_MASK) |
+				   botic_format_values[i];
+	}
+
+	return 0;
+}
+
 #if defined(CONFIG_OF)
 static const struct of_device_id asoc_botic_card_dt_ids[] = {
     { .compatible = "botic-audio-card",
@@ -165,15 +711,48 @@ MODULE_DEVICE_TABLE(of, asoc_botic_card_dt_ids);
 static int asoc_botic_card_probe(struct platform_device *pdev) {
 
 	struct device_node *np = pdev->dev.of_node;
+	struct snd_soc_card *card;
 	struct snd_soc_dai_link *dai;
 	struct botic_priv *priv;
-	int ret;
-
-	dai = botic_card.dai_link;
+	struct snd_soc_dai_link_component *codecs;
+	struct snd_soc_codec_conf *codec_conf;
+	struct snd_soc_dai_link_ch_map *ch_maps;
+	const char *prefix;
+	u32 ch_mask;
+	int i, num_codecs, ret;
 
 	priv = devm_kzalloc(&pdev->dev, sizeof(*priv), GFP_KERNEL);
 	if (!priv)
 		return -ENOMEM;
+
+	card = &priv->card;
+	dai = &priv->dai_link;
+
+	dai->name = "Botic";
+	dai->stream_name = "external";
+	dai->cpus = &priv->cpus;
+	dai->num_cpus = 1;
+	dai->platforms = &priv->platforms;
+	dai->num_platforms = 1;
+	dai->ops = &botic_ops;
+
+	card->name = "Botic";
+	card->owner = THIS_MODULE;
+	card->dai_link = dai;
+	card->num_links = 1;
+	card->late_probe = botic_late_probe;
+	card->controls = botic_card_controls;
+	card->num_controls = ARRAY_SIZE(botic_card_controls);
+	card->dev = &pdev->dev;
+
+	/* The DT label tells several Botic cards apart */
+	ret = snd_soc_of_parse_card_name(card, "label");
+	if (ret)
+		return ret;
+
+	ret = botic_parse_config(&pdev->dev, priv);
+	if (ret)
+		return ret;
 	
 	priv->power_switch = devm_gpiod_get(&pdev->dev, "enable", GPIOD_OUT_LOW);
 	if (IS_ERR(priv->power_switch)) {
@@ -216,32 +795,91 @@ static int asoc_botic_card_probe(struct platform_device *pdev) {
 	}
 	clk_prepare_enable(priv->clk44);
 	priv->clk44_freq = clk_get_rate(priv->clk44);
+	botic_build_rates(priv);
 	priv->mux = devm_clk_get(&pdev->dev, "mux");
 	if (IS_ERR(priv->clk44)) {
 		dev_err(&pdev->dev, "unable to get the mux clock for frequency switches");
 		return PTR_ERR(priv->mux);
 	}
 	
-	dai->codecs->of_node = of_parse_phandle(np, "audio-codec", 0);
-	if (dai->codecs->of_node) {
-		ret = of_property_read_string_index(np, "audio-codec-dai", 0,
-				&dai->codecs->dai_name);
+	/*
+	 * One or more codecs. Each one gets the channels of one serializer
+	 * unless audio-codec-channels gives its channel mask, and a control
+	 * name prefix from audio-codec-prefixes, "DAC<n>" by default. The
+	 * McASP interleaves slot-major, serializer n of N carries channels
+	 * n and n + N.
+	 */
+	num_codecs = of_count_phandle_with_args(np, "audio-codec", NULL);
+	if (num_codecs <= 0)
+		return -ENOENT;
+
+	codecs = devm_kcalloc(&pdev->dev, num_codecs, sizeof(*codecs), GFP_KERNEL);
+	priv->codecs = devm_kcalloc(&pdev->dev, num_codecs,
+				    sizeof(*priv->codecs), GFP_KERNEL);
+	priv->fanout = devm_kcalloc(&pdev->dev, num_codecs,
+				    sizeof(*priv->fanout), GFP_KERNEL);
+	if (!codecs || !priv->codecs || !priv->fanout)
+		return -ENOMEM;
+
+	for (i = 0; i < num_codecs; i++) {
+		codecs[i].of_node = of_parse_phandle(np, "audio-codec", i);
+		if (!codecs[i].of_node)
+			return -ENOENT;
+
+		/* A single DAI name applies to all codecs */
+		ret = of_property_read_string_index(np, "audio-codec-dai",
+				of_property_count_strings(np, "audio-codec-dai") > i ? i : 0,
+				&codecs[i].dai_name);
 		if (ret < 0)
 			return ret;
 	}
-	else
-		return -ENOENT;
+
+	dai->codecs = codecs;
+	dai->num_codecs = num_codecs;
+	priv->num_codecs = num_codecs;
+
+	if (num_codecs > 1) {
+		codec_conf = devm_kcalloc(&pdev->dev, num_codecs,
+					  sizeof(*codec_conf), GFP_KERNEL);
+		ch_maps = devm_kcalloc(&pdev->dev, num_codecs,
+				       sizeof(*ch_maps), GFP_KERNEL);
+		if (!codec_conf || !ch_maps)
+			return -ENOMEM;
+
+		for (i = 0; i < num_codecs; i++) {
+			if (of_property_read_string_index(np, "audio-codec-prefixes",
+							  i, &prefix))
+				prefix = devm_kasprintf(&pdev->dev, GFP_KERNEL,
+							"DAC%d", i);
+			if (!prefix)
+				return -ENOMEM;
+
+			if (of_property_read_u32_index(np, "audio-codec-channels",
+						       i, &ch_mask))
+				ch_mask = BIT(i) | BIT(i + num_codecs);
+
+			codec_conf[i].dlc.of_node = codecs[i].of_node;
+			codec_conf[i].name_prefix = prefix;
+			ch_maps[i].cpu = 0;
+			ch_maps[i].codec = i;
+			ch_maps[i].ch_mask = ch_mask;
+		}
+
+		card->codec_conf = codec_conf;
+		card->num_configs = num_codecs;
+		dai->ch_maps = ch_maps;
+	}
 	dai->cpus->of_node = of_parse_phandle(np, "audio-port", 0);
 	if (!dai->cpus->of_node)
 		return -ENOENT;
 	
 	dai->platforms->of_node = dai->cpus->of_node;
-	botic_card.dev = &pdev->dev;
-	
-	snd_soc_card_set_drvdata(&botic_card, priv);
+
+	botic_invalidate_config(priv);
+	snd_soc_card_set_drvdata(card, priv);
 
 	/* register card with ALSA core*/
-	ret = devm_snd_soc_register_card(&pdev->dev, &botic_card);
+	ret = devm_snd_soc_register_card(&pdev->dev, card);
 	if (ret) {
 		dev_err(&pdev->dev, "snd_soc_register_card failed (%d)\n", ret);
 		return ret;
@@ -276,10 +914,19 @@ static void asoc_botic_card_shutdown(struct platform_device *pdev) {
 static int asoc_botic_card_suspend(struct platform_device *pdev, pm_message_t state) {
 	struct snd_soc_card *card = platform_get_drvdata(pdev);
 	struct botic_priv *priv = snd_soc_card_get_drvdata(card);
+	int ret;
+
+	/* let the components save their state while they are still powered */
+	ret = snd_soc_suspend(card->dev);
+	if (ret)
+		return ret;
 
 	gpiod_set_value(priv->power_switch, 0);
         /* switch the card off before going suspend */
 
+	/* The DAC loses its configuration while powered off */
+	botic_invalidate_config(priv);
+
 	return 0;
 }
 
@@ -290,7 +937,10 @@ static int asoc_botic_card_resume(struct platform_device *pdev) {
 	gpiod_set_value(priv->power_switch, 1);
 	/* switch the card on after resuming from suspend */
 
-	return 0;
+	botic_invalidate_config(priv);
+
+	/* restores the codec registers once the DAC is powered again */
+	return snd_soc_resume(card->dev);
 }
 #else
 #define asoc_botic_card_suspend NULL
@@ -311,11 +961,11 @@ static struct platform_driver asoc_botic_card_driver = {
 
 module_platform_driver(asoc_botic_card_driver);
 
-module_param(blr_ratio, int, 0644);
-MODULE_PARM_DESC(blr_ratio, "force BCLK/LRCLK ratio");
+module_param(blr_ratio, int, 0444);
+MODULE_PARM_DESC(blr_ratio, "default BCLK/LRCLK ratio at probe, unless set by DT");
 
-module_param(dai_format, int, 0644);
-MODULE_PARM_DESC(dai_format, "Set DAI format to non-default setting (e.g. right justified).");
+module_param(dai_format, int, 0444);
+MODULE_PARM_DESC(dai_format, "Default DAI format (e.g. right justified) at probe, unless set by DT");
 
 MODULE_AUTHOR("Christian Kröner");
 MODULE_DESCRIPTION("ASoC Botic sound card (rewrite)");
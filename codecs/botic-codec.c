@@ -13,6 +13,7 @@
 #include <sound/core.h>
 #include <sound/pcm.h>
 #include <sound/soc.h>
+#include "dsd-rate.h"
 
 /* External module: include config */
 #include <generated/autoconf.h>
@@ -30,13 +31,25 @@
             SNDRV_PCM_FMTBIT_DSD_U32_LE | \
             0)
 
+#define BOTIC_PCM_RATE_MAX 384000
+
+static int botic_codec_startup(struct snd_pcm_substream *substream,
+        struct snd_soc_dai *dai)
+{
+    return dsd_rate_constrain(substream->runtime, BOTIC_PCM_RATE_MAX);
+}
+
+static const struct snd_soc_dai_ops botic_codec_dai_ops = {
+    .startup = botic_codec_startup,
+};
+
 static struct snd_soc_dai_driver botic_codec_dai = {
     .name = BOTIC_CODEC_DAI_NAME,
     .playback = {
         .channels_min = 2,
         .channels_max = 8,
         .rate_min = 22050,
-        .rate_max = 384000,
+        .rate_max = DSD_RATE_MAX,
         .rates = BOTIC_RATES,
         .formats = BOTIC_FORMATS,
     },
@@ -48,6 +61,7 @@ static struct snd_soc_dai_driver botic_codec_dai = {
         .rates = BOTIC_RATES,
         .formats = BOTIC_FORMATS,
     },
+    .ops = &botic_codec_dai_ops,
 };
 
 static const struct snd_kcontrol_new botic_codec_controls[] = {
@@ -0,0 +1,52 @@
+#ifndef _DSD_RATE_H
+#define _DSD_RATE_H
+
+/*
+ * Rate limits of the DACs on the Botic link
+ *
+ * DSD goes up to DSD1024 as DSD_U32 frames, which is far above the rates
+ * the DACs accept for PCM. The DAI driver states the DSD maximum as
+ * rate_max, dsd_rate_constrain() caps PCM at the codec's own limit.
+ */
+
+#include <sound/pcm.h>
+#include <sound/pcm_params.h>
+
+#define DSD_RATE_MAX		1536000	/* DSD1024 as DSD_U32 frames */
+
+static inline bool dsd_rate_mask_has_dsd(const struct snd_mask *fmt)
+{
+	return snd_mask_test_format(fmt, SNDRV_PCM_FORMAT_DSD_U8) ||
+	       snd_mask_test_format(fmt, SNDRV_PCM_FORMAT_DSD_U16_LE) ||
+	       snd_mask_test_format(fmt, SNDRV_PCM_FORMAT_DSD_U16_BE) ||
+	       snd_mask_test_format(fmt, SNDRV_PCM_FORMAT_DSD_U32_LE) ||
+	       snd_mask_test_format(fmt, SNDRV_PCM_FORMAT_DSD_U32_BE);
+}
+
+/* The PCM maximum is the rule's private data */
+static inline int dsd_rate_hw_rule(struct snd_pcm_hw_params *params,
+				   struct snd_pcm_hw_rule *rule)
+{
+	struct snd_mask *fmt = hw_param_mask(params, SNDRV_PCM_HW_PARAM_FORMAT);
+	struct snd_interval range;
+
+	snd_interval_any(&range);
+	if (dsd_rate_mask_has_dsd(fmt))
+		range.max = DSD_RATE_MAX;
+	else
+		range.max = (unsigned long)rule->private;
+
+	return snd_interval_refine(hw_param_interval(params, rule->var), &range);
+}
+
+/* From the DAI startup: PCM up to pcm_max, DSD up to DSD_RATE_MAX */
+static inline int dsd_rate_constrain(struct snd_pcm_runtime *runtime,
+				     unsigned int pcm_max)
+{
+	return snd_pcm_hw_rule_add(runtime, 0, SNDRV_PCM_HW_PARAM_RATE,
+				   dsd_rate_hw_rule,
+				   (void *)(unsigned long)pcm_max,
+				   SNDRV_PCM_HW_PARAM_FORMAT, -1);
+}
+
+#endif
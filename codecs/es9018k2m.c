@@ -11,12 +11,19 @@
 #include <linux/platform_device.h>
 #include <linux/i2c.h>
 #include <linux/of_platform.h>
+#include <linux/uaccess.h>
+#include <linux/iopoll.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
 #include <sound/soc.h>
 #include <sound/pcm_params.h>
 #include <sound/tlv.h>
 #include "es9018k2m.h"
+#include "ess-batch.h"
+#include "ess-volume.h"
+#include "dsd-rate.h"
 
 /* External module: include config */
 #include <generated/autoconf.h>
@@ -62,7 +69,7 @@ static bool es9018k2m_readable_reg(struct device *dev, unsigned int reg)
 {
 	if(reg <= ES9018K2M_CACHEREGNUM && reg != 2 && reg !=3)
 		return 1;
-	else if(65 <= reg && reg <= 69)
+	else if(64 <= reg && reg <= 69)
 		return 1;
 	else if(70 <= reg && reg <= 93)
 		return 1;
@@ -79,15 +86,76 @@ static bool es9018k2m_writeable_reg(struct device *dev, unsigned int reg)
 	else
 		return 1;
 }
-/*
+
 static bool es9018k2m_volatile_reg(struct device *dev, unsigned int reg)
 {
-	return false;
+	/* Coefficient address and data are consumed by every write */
+	if(reg >= ES9018K2M_program_FIR_ADDR && reg <= ES9018K2M_program_FIR_DATAC)
+		return 1;
+	else if(reg >= 64)
+		return 1;
+	else
+		return 0;
 }
-*/
+
+/* May be rewritten with its cached value to join two bursts */
+static bool es9018k2m_bridgeable_reg(struct device *dev, unsigned int reg)
+{
+	return es9018k2m_writeable_reg(dev, reg) && !es9018k2m_volatile_reg(dev, reg);
+}
+
+/*
+ * Programmable FIR table as passed through the "FIR Coefficients" control:
+ * after the [tag, length] words of the TLV buffer, struct
+ * es9018k2m_fir_table followed by stage1_len and then stage2_len
+ * coefficients, each a little endian 32 bit word of which the low 24 bits
+ * are used. An empty table switches back to the builtin filters. The tag
+ * is not interpreted and read back as 0.
+ */
+#define ES9018K2M_FIR_TLV_HDR		(2 * sizeof(unsigned int))
+#define ES9018K2M_FIR_STAGE1_MAX	128
+#define ES9018K2M_FIR_STAGE2_MAX	16
+#define ES9018K2M_FIR_TABLE_MAX		(sizeof(struct es9018k2m_fir_table) + \
+		4 * (ES9018K2M_FIR_STAGE1_MAX + ES9018K2M_FIR_STAGE2_MAX))
+
+/* program_FIR_ADDR: bit 7 selects stage 2 */
+#define ES9018K2M_FIR_ADDR_STAGE2	0x80
+/* program_FIR_CONTROL */
+#define ES9018K2M_FIR_ENABLE		0x01
+#define ES9018K2M_FIR_WRITE_ENABLE	0x02
+#define ES9018K2M_FIR_STAGE2_EVEN	0x04
+
+struct es9018k2m_fir_table {
+	__le16 stage1_len;
+	__le16 stage2_len;
+	__le32 coefs[];
+} __packed;
+
+/* Lock wait after the stream started */
+#define ES9018K2M_LOCK_POLL_US		500
+#define ES9018K2M_LOCK_TIMEOUT_US	500000
+
 struct es9018k2m_priv {
+    struct device *dev;
     struct regmap *regmap;
+    struct ess_batch batch;
     unsigned int fmt;
+    unsigned int volume;
+
+    /* "DSD DPLL" setting, replaced by the widest bandwidth above DSD256 */
+    unsigned int dsd_dpll;
+    bool dsd_dpll_high;
+
+    /* DPLL lock time of the last stream start, -1 if it did not lock */
+    struct work_struct lock_work;
+    ktime_t lock_start;
+    bool lock_pending;
+    int lock_time_us;
+
+    /* Last table loaded into the DAC, returned on read */
+    struct mutex fir_lock;
+    u8 fir_table[ES9018K2M_FIR_TABLE_MAX];
+    unsigned int fir_table_len;
 };
 
 #define ES9018K2M_FORMATS (\
@@ -119,7 +187,46 @@ static const char * const es9018k2m_dpll_texts[] = {
 };
 
 static SOC_ENUM_SINGLE_DECL(es9018k2m_dpll_i2s, ES9018K2M_DPLL, 4, es9018k2m_dpll_texts);
-static SOC_ENUM_SINGLE_DECL(es9018k2m_dpll_dsd, ES9018K2M_DPLL, 0, es9018k2m_dpll_texts);
+static SOC_ENUM_SINGLE_EXT_DECL(es9018k2m_dpll_dsd, es9018k2m_dpll_texts);
+
+#define ES9018K2M_DPLL_DSD_MASK		0x0f
+#define ES9018K2M_DPLL_DSD_HI		0x0f
+
+static int es9018k2m_dsd_dpll_get(struct snd_kcontrol *kcontrol,
+	struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(component);
+
+	ucontrol->value.enumerated.item[0] = es9018k2m->dsd_dpll;
+	return 0;
+}
+
+/* Takes effect right away unless a high rate DSD stream overrides it */
+static int es9018k2m_dsd_dpll_put(struct snd_kcontrol *kcontrol,
+	struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(component);
+	unsigned int value = ucontrol->value.enumerated.item[0];
+	int ret;
+
+	if (value >= ARRAY_SIZE(es9018k2m_dpll_texts))
+		return -EINVAL;
+
+	if (value == es9018k2m->dsd_dpll)
+		return 0;
+
+	if (!READ_ONCE(es9018k2m->dsd_dpll_high)) {
+		ret = regmap_update_bits(es9018k2m->regmap, ES9018K2M_DPLL,
+					 ES9018K2M_DPLL_DSD_MASK, value);
+		if (ret)
+			return ret;
+	}
+
+	es9018k2m->dsd_dpll = value;
+	return 1;
+}
 
 static const char * const es9018k2m_deemph_texts[] = {
 	"OFF",
@@ -179,18 +286,245 @@ static SOC_ENUM_SINGLE_DECL(es9018k2m_osf, ES9018K2M_INPUT_SELECT, 0, es9018k2m_
 
 static SOC_ENUM_SINGLE_DECL(es9018k2m_iir, ES9018K2M_INPUT_SELECT, 2, es9018k2m_onoff_texts);
 
-static const DECLARE_TLV_DB_SCALE(es9018k2m_dac_tlv, -12750, 50, 1);
+static int es9018k2m_volume_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(component);
+
+	ucontrol->value.integer.value[0] = es9018k2m->volume;
+	return 0;
+}
+
+/* VOLUME1, VOLUME2 and MASTERTRIM0-3 are adjacent: one 6 byte burst */
+static int es9018k2m_volume_put(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(component);
+	unsigned int value = ucontrol->value.integer.value[0];
+	u8 buf[6];
+	int ret;
+
+	if (value > ESS_VOLUME_MAX)
+		return -EINVAL;
+
+	if (value == es9018k2m->volume)
+		return 0;
+
+	ess_volume_split(value, &buf[0], &buf[2]);
+	buf[1] = buf[0];
+
+	ret = regmap_bulk_write(es9018k2m->regmap, ES9018K2M_VOLUME1,
+				buf, sizeof(buf));
+	if (ret)
+		return ret;
+
+	es9018k2m->volume = value;
+	return 1;
+}
+
+/*
+ * Every coefficient is a single burst of address and data registers. The
+ * readback is done after the write enable is dropped, so a wrong word in
+ * the coefficient RAM is caught before the filter is switched in.
+ */
+static int es9018k2m_fir_stage(struct es9018k2m_priv *es9018k2m, u8 stage,
+		const __le32 *coefs, unsigned int len, bool verify)
+{
+	u8 buf[4], rb[3];
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < len; i++) {
+		u32 coef = le32_to_cpu(coefs[i]);
+
+		buf[0] = stage | i;
+		buf[1] = coef & 0xff;
+		buf[2] = (coef >> 8) & 0xff;
+		buf[3] = (coef >> 16) & 0xff;
+
+		if (!verify) {
+			ret = regmap_bulk_write(es9018k2m->regmap,
+					ES9018K2M_program_FIR_ADDR, buf, 4);
+		} else {
+			ret = regmap_write(es9018k2m->regmap,
+					ES9018K2M_program_FIR_ADDR, buf[0]);
+			if (!ret)
+				ret = regmap_bulk_read(es9018k2m->regmap,
+						ES9018K2M_program_FIR_READBACK,
+						rb, sizeof(rb));
+			if (!ret && memcmp(rb, &buf[1], sizeof(rb)))
+				ret = -EIO;
+		}
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int es9018k2m_fir_load(struct es9018k2m_priv *es9018k2m,
+		const struct es9018k2m_fir_table *table)
+{
+	struct regmap *regmap = es9018k2m->regmap;
+	unsigned int n1 = le16_to_cpu(table->stage1_len);
+	unsigned int n2 = le16_to_cpu(table->stage2_len);
+	unsigned int mute, ctrl = 0;
+	int ret;
+
+	/* Mute while the coefficient RAM is inconsistent */
+	regmap_read(regmap, ES9018K2M_GENERAL_SET, &mute);
+	ret = regmap_update_bits(regmap, ES9018K2M_GENERAL_SET, 0x01, 0x01);
+	if (ret)
+		return ret;
+
+	ret = regmap_write(regmap, ES9018K2M_program_FIR_CONTROL,
+			   ES9018K2M_FIR_WRITE_ENABLE);
+	if (!ret)
+		ret = es9018k2m_fir_stage(es9018k2m, 0, table->coefs, n1, false);
+	if (!ret)
+		ret = es9018k2m_fir_stage(es9018k2m, ES9018K2M_FIR_ADDR_STAGE2,
+					  table->coefs + n1, n2, false);
+	if (!ret)
+		ret = regmap_write(regmap, ES9018K2M_program_FIR_CONTROL, 0);
+	if (!ret)
+		ret = es9018k2m_fir_stage(es9018k2m, 0, table->coefs, n1, true);
+	if (!ret)
+		ret = es9018k2m_fir_stage(es9018k2m, ES9018K2M_FIR_ADDR_STAGE2,
+					  table->coefs + n1, n2, true);
+
+	if (!ret && (n1 || n2)) {
+		ctrl = ES9018K2M_FIR_ENABLE;
+		if (!(n2 & 1))
+			ctrl |= ES9018K2M_FIR_STAGE2_EVEN;
+	}
+	regmap_write(regmap, ES9018K2M_program_FIR_CONTROL, ctrl);
+	regmap_update_bits(regmap, ES9018K2M_GENERAL_SET, 0x01, mute);
+
+	return ret;
+}
+
+static int es9018k2m_fir_put(struct snd_kcontrol *kcontrol,
+		const unsigned int __user *bytes, unsigned int size)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(component);
+	struct es9018k2m_fir_table *table;
+	unsigned int hdr[2];
+	unsigned int n1, n2;
+	int ret;
+
+	if (size < ES9018K2M_FIR_TLV_HDR + sizeof(*table))
+		return -EINVAL;
+
+	if (copy_from_user(hdr, bytes, sizeof(hdr)))
+		return -EFAULT;
+
+	size -= ES9018K2M_FIR_TLV_HDR;
+	if (hdr[1] != size)
+		return -EINVAL;
+
+	table = memdup_user(bytes + 2, size);
+	if (IS_ERR(table))
+		return PTR_ERR(table);
+
+	n1 = le16_to_cpu(table->stage1_len);
+	n2 = le16_to_cpu(table->stage2_len);
+	if (n1 > ES9018K2M_FIR_STAGE1_MAX || n2 > ES9018K2M_FIR_STAGE2_MAX ||
+	    size != sizeof(*table) + 4 * (n1 + n2)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	mutex_lock(&es9018k2m->fir_lock);
+	if (size == es9018k2m->fir_table_len &&
+	    !memcmp(es9018k2m->fir_table, table, size)) {
+		ret = 0;
+	} else {
+		ret = es9018k2m_fir_load(es9018k2m, table);
+		if (ret) {
+			dev_err(component->dev, "FIR upload failed: %d\n", ret);
+			es9018k2m->fir_table_len = 0;
+		} else {
+			memcpy(es9018k2m->fir_table, table, size);
+			es9018k2m->fir_table_len = size;
+			ret = 1;
+		}
+	}
+	mutex_unlock(&es9018k2m->fir_lock);
+
+out:
+	kfree(table);
+	return ret;
+}
+
+static int es9018k2m_fir_get(struct snd_kcontrol *kcontrol,
+		unsigned int __user *bytes, unsigned int size)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(component);
+	struct es9018k2m_fir_table empty = { 0 };
+	const void *table = &empty;
+	unsigned int hdr[2] = { 0, sizeof(empty) };
+	int ret = 0;
+
+	mutex_lock(&es9018k2m->fir_lock);
+	if (es9018k2m->fir_table_len) {
+		table = es9018k2m->fir_table;
+		hdr[1] = es9018k2m->fir_table_len;
+	}
+
+	if (size < ES9018K2M_FIR_TLV_HDR + hdr[1])
+		ret = -ENOSPC;
+	else if (copy_to_user(bytes, hdr, sizeof(hdr)) ||
+		 copy_to_user(bytes + 2, table, hdr[1]))
+		ret = -EFAULT;
+	mutex_unlock(&es9018k2m->fir_lock);
+
+	return ret;
+}
+
+static int es9018k2m_lock_time_info(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = -1;
+	uinfo->value.integer.max = ES9018K2M_LOCK_TIMEOUT_US;
+	return 0;
+}
+
+/* In microseconds */
+static int es9018k2m_lock_time_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(component);
+
+	ucontrol->value.integer.value[0] = READ_ONCE(es9018k2m->lock_time_us);
+	return 0;
+}
 
 static const struct snd_kcontrol_new es9018k2m_codec_controls[] = {
-    SOC_DOUBLE_R_TLV("Master Playback Volume", ES9018K2M_VOLUME1, ES9018K2M_VOLUME2, 0, 0xFF, 1, es9018k2m_dac_tlv),
+    SOC_SINGLE_EXT_TLV("Master Playback Volume", SND_SOC_NOPM, 0, ESS_VOLUME_MAX, 0, es9018k2m_volume_get, es9018k2m_volume_put, ess_volume_tlv),
     SOC_ENUM("Deemph", es9018k2m_deemph),
     SOC_ENUM("I2S DPLL", es9018k2m_dpll_i2s),
-    SOC_ENUM("DSD DPLL", es9018k2m_dpll_dsd),
+    SOC_ENUM_EXT("DSD DPLL", es9018k2m_dpll_dsd, es9018k2m_dsd_dpll_get, es9018k2m_dsd_dpll_put),
     SOC_ENUM("CH Map", es9018k2m_chmap),
     SOC_ENUM("IIR BW", es9018k2m_iirbw),
     SOC_ENUM("Use IIR", es9018k2m_iir),
     SOC_ENUM("FIR", es9018k2m_fir),
     SOC_ENUM("Use OSF", es9018k2m_osf),
+    {
+	.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name = "DPLL Lock Time",
+	.access = SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE,
+	.info = es9018k2m_lock_time_info,
+	.get = es9018k2m_lock_time_get,
+    },
+    SND_SOC_BYTES_TLV("FIR Coefficients", ES9018K2M_FIR_TLV_HDR + ES9018K2M_FIR_TABLE_MAX,
+		      es9018k2m_fir_get, es9018k2m_fir_put),
 };
 
 const struct regmap_config es9018k2m_regmap = {
@@ -201,46 +535,185 @@ const struct regmap_config es9018k2m_regmap = {
 	.num_reg_defaults = ARRAY_SIZE(es9018k2m_reg_defaults),
 	.writeable_reg = es9018k2m_writeable_reg,
 	.readable_reg = es9018k2m_readable_reg,
+	.volatile_reg = es9018k2m_volatile_reg,
 	.cache_type = REGCACHE_RBTREE,
 };
 EXPORT_SYMBOL_GPL(es9018k2m_regmap);
 /*
+ * INPUT_CONFIG: bits 7:6 serial word length, bits 5:4 serial format,
+ * bits 3:2 automatic input selection, bits 1:0 input.
+ * The input is programmed from the stream so the DAC does not have to
+ * detect it first.
+ */
+#define ES9018K2M_INPUT_LEN_MASK	0xc0
+#define ES9018K2M_INPUT_LEN_16		0x00
+#define ES9018K2M_INPUT_LEN_24		0x40
+#define ES9018K2M_INPUT_LEN_32		0x80
+#define ES9018K2M_INPUT_FMT_MASK	0x30
+#define ES9018K2M_INPUT_FMT_I2S		0x00
+#define ES9018K2M_INPUT_FMT_LEFT_J	0x10
+#define ES9018K2M_INPUT_FMT_RIGHT_J	0x20
+#define ES9018K2M_INPUT_SEL_MASK	0x0f
+#define ES9018K2M_INPUT_SEL_SERIAL	0x00
+#define ES9018K2M_INPUT_SEL_DSD		0x03
+
+/*
+ * I2S is specified up to 384 kHz. Above DSD256 the DSD DPLL only holds
+ * lock with the widest bandwidth.
+ */
+#define ES9018K2M_PCM_RATE_MAX		384000
+#define ES9018K2M_DSD256_BITRATE	12288000
+
+static int es9018k2m_startup(struct snd_pcm_substream *substream,
+	struct snd_soc_dai *dai)
+{
+	return dsd_rate_constrain(substream->runtime, ES9018K2M_PCM_RATE_MAX);
+}
+
+/* Only staged, goes out with the next hw_params */
+static int es9018k2m_set_fmt(struct snd_soc_dai *dai, unsigned int fmt)
+{
+	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(dai->component);
+	u8 val;
+
+	switch (fmt & SND_SOC_DAIFMT_FORMAT_MASK) {
+	case SND_SOC_DAIFMT_I2S:
+		val = ES9018K2M_INPUT_FMT_I2S;
+		break;
+	case SND_SOC_DAIFMT_LEFT_J:
+		val = ES9018K2M_INPUT_FMT_LEFT_J;
+		break;
+	case SND_SOC_DAIFMT_RIGHT_J:
+		val = ES9018K2M_INPUT_FMT_RIGHT_J;
+		break;
+	default:
+		dev_warn(dai->dev, "unsupported DAI fmt %d", fmt);
+		return -EINVAL;
+	}
+
+	ess_batch_update_bits(&es9018k2m->batch, ES9018K2M_INPUT_CONFIG,
+			      ES9018K2M_INPUT_FMT_MASK, val);
+	es9018k2m->fmt = fmt;
+
+	return 0;
+}
+
 static int es9018k2m_hw_params(
 	struct snd_pcm_substream *substream, struct snd_pcm_hw_params *params,
 	struct snd_soc_dai *dai)
 {
 	struct snd_soc_component *component = dai->component;
 	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(component);
-
-	unsigned int iface;
-	
-	regmap_read(es9018k2m->regmap, ES9018K2M_INPUT_CONFIG, &iface);
-	
-	iface &= 0x3f;
+	u8 len, sel = ES9018K2M_INPUT_SEL_SERIAL;
+	bool high;
 
 	switch (params_format(params)) {
-		case SNDRV_PCM_FORMAT_S16_LE:
-			iface |= 0x0;
-			break;
-		case SNDRV_PCM_FORMAT_S24_LE:
-			iface |= 0x40;
-			break;
-		case SNDRV_PCM_FORMAT_S32_LE:
-			iface |= 0x80;
-			break;
-		default:
-			return 0;
+	case SNDRV_PCM_FORMAT_S16_LE:
+		len = ES9018K2M_INPUT_LEN_16;
+		break;
+	case SNDRV_PCM_FORMAT_S24_3LE:
+	case SNDRV_PCM_FORMAT_S24_LE:
+		len = ES9018K2M_INPUT_LEN_24;
+		break;
+	case SNDRV_PCM_FORMAT_S32_LE:
+		len = ES9018K2M_INPUT_LEN_32;
+		break;
+	case SNDRV_PCM_FORMAT_DSD_U32_LE:
+		len = ES9018K2M_INPUT_LEN_32;
+		sel = ES9018K2M_INPUT_SEL_DSD;
+		break;
+	default:
+		dev_warn(component->dev, "unsupported PCM format %d", params_format(params));
+		return -EINVAL;
+	}
+
+	ess_batch_update_bits(&es9018k2m->batch, ES9018K2M_INPUT_CONFIG,
+			      ES9018K2M_INPUT_LEN_MASK | ES9018K2M_INPUT_SEL_MASK,
+			      len | sel);
+
+	/* The "DSD DPLL" setting is back for anything up to DSD256 */
+	high = sel == ES9018K2M_INPUT_SEL_DSD &&
+	       params_rate(params) * params_width(params) > ES9018K2M_DSD256_BITRATE;
+	WRITE_ONCE(es9018k2m->dsd_dpll_high, high);
+	ess_batch_update_bits(&es9018k2m->batch, ES9018K2M_DPLL,
+			      ES9018K2M_DPLL_DSD_MASK,
+			      high ? ES9018K2M_DPLL_DSD_HI : es9018k2m->dsd_dpll);
+
+	/* Written while the CPU DAI is set up, prepare waits for it */
+	ess_batch_schedule(&es9018k2m->batch);
+
+	return 0;
+}
+
+static int es9018k2m_prepare(struct snd_pcm_substream *substream,
+	struct snd_soc_dai *dai)
+{
+	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(dai->component);
+
+	return ess_batch_sync(&es9018k2m->batch);
+}
+
+/* Time from the stream start until the DPLL reports lock */
+static void es9018k2m_lock_work(struct work_struct *work)
+{
+	struct es9018k2m_priv *es9018k2m =
+		container_of(work, struct es9018k2m_priv, lock_work);
+	unsigned int status = 0;
+	int ret, err = 0;
+
+	ret = read_poll_timeout(regmap_read, err,
+				err || (status & 0x01) ||
+				!READ_ONCE(es9018k2m->lock_pending),
+				ES9018K2M_LOCK_POLL_US, ES9018K2M_LOCK_TIMEOUT_US,
+				false, es9018k2m->regmap,
+				ES9018K2M_CHIP_STATUS, &status);
+	if (err || !READ_ONCE(es9018k2m->lock_pending))
+		return;
+
+	if (ret) {
+		dev_warn(es9018k2m->dev, "DPLL did not lock within %dms\n",
+			 ES9018K2M_LOCK_TIMEOUT_US / 1000);
+		WRITE_ONCE(es9018k2m->lock_time_us, -1);
+		return;
 	}
 
-	regmap_write(es9018k2m->regmap, ES9018K2M_INPUT_CONFIG, iface);
+	WRITE_ONCE(es9018k2m->lock_time_us,
+		   ktime_us_delta(ktime_get(), es9018k2m->lock_start));
+	dev_dbg(es9018k2m->dev, "DPLL locked after %dus\n",
+		es9018k2m->lock_time_us);
+}
+
+static int es9018k2m_trigger(struct snd_pcm_substream *substream, int cmd,
+	struct snd_soc_dai *dai)
+{
+	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(dai->component);
+
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_START:
+	case SNDRV_PCM_TRIGGER_RESUME:
+	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+		es9018k2m->lock_start = ktime_get();
+		WRITE_ONCE(es9018k2m->lock_pending, true);
+		queue_work(system_highpri_wq, &es9018k2m->lock_work);
+		break;
+	case SNDRV_PCM_TRIGGER_STOP:
+	case SNDRV_PCM_TRIGGER_SUSPEND:
+	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
+		WRITE_ONCE(es9018k2m->lock_pending, false);
+		break;
+	}
 
 	return 0;
 }
 
 static const struct snd_soc_dai_ops es9018k2m_dai_ops = {
+	.startup	= es9018k2m_startup,
+	.set_fmt	= es9018k2m_set_fmt,
 	.hw_params	= es9018k2m_hw_params,
+	.prepare	= es9018k2m_prepare,
+	.trigger	= es9018k2m_trigger,
 };
-*/
+
 static struct snd_soc_dai_driver es9018k2m_dai = {
     .name = ES9018K2M_CODEC_DAI_NAME,
     .playback = {
@@ -248,15 +721,79 @@ static struct snd_soc_dai_driver es9018k2m_dai = {
         .channels_min = 1,
         .channels_max = 2,
         .rate_min = 22050,
-        .rate_max = 384000,
+        .rate_max = DSD_RATE_MAX,
         .rates = SNDRV_PCM_RATE_KNOT,
         .formats = ES9018K2M_FORMATS,
     },
-/*    .ops = &es9018k2m_dai_ops,*/
+    .ops = &es9018k2m_dai_ops,
 };
 
+static void es9018k2m_remove(struct snd_soc_component *component)
+{
+	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(component);
+
+	WRITE_ONCE(es9018k2m->lock_pending, false);
+	cancel_work_sync(&es9018k2m->lock_work);
+	ess_batch_cancel(&es9018k2m->batch);
+}
+
+#ifdef CONFIG_PM
+/*
+ * The DAC is powered down by the card, keep the registers in the cache and
+ * let regcache_sync() write back the non-default ones in bursts.
+ */
+static int es9018k2m_suspend(struct snd_soc_component *component)
+{
+	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(component);
+
+	ess_batch_cancel(&es9018k2m->batch);
+	regcache_cache_only(es9018k2m->regmap, true);
+	regcache_mark_dirty(es9018k2m->regmap);
+
+	return 0;
+}
+
+static int es9018k2m_resume(struct snd_soc_component *component)
+{
+	struct es9018k2m_priv *es9018k2m = snd_soc_component_get_drvdata(component);
+	int ret;
+
+	regcache_cache_only(es9018k2m->regmap, false);
+	ret = regcache_sync(es9018k2m->regmap);
+	if (ret) {
+		dev_err(component->dev, "failed to restore registers: %d\n", ret);
+		return ret;
+	}
+
+	/* Anything staged while suspended */
+	ret = ess_batch_flush(&es9018k2m->batch);
+	if (ret)
+		return ret;
+
+	/* The coefficient RAM is not cached, load the last table again */
+	mutex_lock(&es9018k2m->fir_lock);
+	if (es9018k2m->fir_table_len) {
+		ret = es9018k2m_fir_load(es9018k2m,
+				(struct es9018k2m_fir_table *)es9018k2m->fir_table);
+		if (ret) {
+			dev_err(component->dev, "FIR upload failed: %d\n", ret);
+			es9018k2m->fir_table_len = 0;
+		}
+	}
+	mutex_unlock(&es9018k2m->fir_lock);
+
+	return ret;
+}
+#else
+#define es9018k2m_suspend NULL
+#define es9018k2m_resume NULL
+#endif
+
 static struct snd_soc_component_driver es9018k2m_component_driver = {
     .controls = es9018k2m_codec_controls,
+    .remove = es9018k2m_remove,
+    .suspend = es9018k2m_suspend,
+    .resume = es9018k2m_resume,
     .num_controls = ARRAY_SIZE(es9018k2m_codec_controls),
     .idle_bias_on = 1,
     .use_pmdown_time = 1,
@@ -274,7 +811,15 @@ int es9018k2m_probe(struct device *dev, struct regmap *regmap)
 		return -ENOMEM;
 	
 	dev_set_drvdata(dev, es9018k2m);
+	es9018k2m->dev = dev;
 	es9018k2m->regmap = regmap;
+	ess_batch_init(&es9018k2m->batch, dev, regmap, es9018k2m_bridgeable_reg);
+	INIT_WORK(&es9018k2m->lock_work, es9018k2m_lock_work);
+	es9018k2m->volume = ESS_VOLUME_MAX;
+	/* From the register defaults, no bus access */
+	regmap_read(regmap, ES9018K2M_DPLL, &es9018k2m->dsd_dpll);
+	es9018k2m->dsd_dpll &= ES9018K2M_DPLL_DSD_MASK;
+	mutex_init(&es9018k2m->fir_lock);
 	ret = devm_snd_soc_register_component(dev, &es9018k2m_component_driver,
 				    &es9018k2m_dai, 1);
 	if (ret != 0) {
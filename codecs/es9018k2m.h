@@ -39,6 +39,10 @@
 #define ES9018K2M_program_FIR_DATA2	   		0x1C
 #define ES9018K2M_program_FIR_DATAC	   		0x1D
 #define ES9018K2M_program_FIR_CONTROL	   		0x1E
+/* Bit 0: DPLL lock, read only */
+#define ES9018K2M_CHIP_STATUS				0x40
+/* Coefficient at program_FIR_ADDR, read only */
+#define ES9018K2M_program_FIR_READBACK			0x46
 
 #define ES9018K2M_CACHEREGNUM 	0x1E
 
@@ -0,0 +1,192 @@
+#ifndef _ESS_BATCH_H
+#define _ESS_BATCH_H
+
+/*
+ * Register write batching for the ESS DACs
+ *
+ * Every register access to the DAC is a separate I2C transaction, so
+ * several update_bits() calls on the same or on neighbouring registers are
+ * expensive. Changes are staged here instead: updates of the same register
+ * are merged, and ess_batch_flush() writes all changed registers as a few
+ * auto-incrementing bursts through regmap_bulk_write(). Small gaps between
+ * changed registers are bridged by rewriting their cached value when this
+ * is safe (writeable, not volatile), which is cheaper than a new
+ * transaction.
+ *
+ * From hw_params the flush can be handed to a worker with
+ * ess_batch_schedule(), so the I2C traffic overlaps with the setup of the
+ * CPU DAI and DMA instead of delaying it; ess_batch_sync() at prepare time
+ * makes sure it is done before the stream starts.
+ */
+
+#include <linux/bitmap.h>
+#include <linux/mutex.h>
+#include <linux/regmap.h>
+#include <linux/workqueue.h>
+
+#define ESS_BATCH_MAX_REGS	128
+/* Largest run of unchanged registers written to join two bursts */
+#define ESS_BATCH_MAX_GAP	2
+
+struct ess_batch {
+	struct device *dev;
+	struct regmap *regmap;
+	/* Returns true if a register may be rewritten with its cached value */
+	bool (*bridgeable)(struct device *dev, unsigned int reg);
+	struct mutex lock;
+	struct work_struct work;
+	int error; /* of the last scheduled flush */
+	DECLARE_BITMAP(dirty, ESS_BATCH_MAX_REGS);
+	u8 mask[ESS_BATCH_MAX_REGS];
+	u8 val[ESS_BATCH_MAX_REGS];
+};
+
+static inline int ess_batch_flush(struct ess_batch *batch);
+
+static inline void ess_batch_work(struct work_struct *work)
+{
+	struct ess_batch *batch = container_of(work, struct ess_batch, work);
+	int ret;
+
+	ret = ess_batch_flush(batch);
+	if (ret)
+		WRITE_ONCE(batch->error, ret);
+}
+
+static inline void ess_batch_init(struct ess_batch *batch, struct device *dev,
+				  struct regmap *regmap,
+				  bool (*bridgeable)(struct device *dev,
+						     unsigned int reg))
+{
+	batch->dev = dev;
+	batch->regmap = regmap;
+	batch->bridgeable = bridgeable;
+	mutex_init(&batch->lock);
+	INIT_WORK(&batch->work, ess_batch_work);
+	batch->error = 0;
+	bitmap_zero(batch->dirty, ESS_BATCH_MAX_REGS);
+}
+
+/* Stage a change, merged with earlier staged changes of the same register */
+static inline void ess_batch_update_bits(struct ess_batch *batch,
+					 unsigned int reg, u8 mask, u8 val)
+{
+	if (WARN_ON(reg >= ESS_BATCH_MAX_REGS))
+		return;
+
+	mutex_lock(&batch->lock);
+	if (!test_and_set_bit(reg, batch->dirty)) {
+		batch->mask[reg] = 0;
+		batch->val[reg] = 0;
+	}
+	batch->mask[reg] |= mask;
+	batch->val[reg] = (batch->val[reg] & ~mask) | (val & mask);
+	mutex_unlock(&batch->lock);
+}
+
+static inline void ess_batch_write(struct ess_batch *batch, unsigned int reg,
+				   u8 val)
+{
+	ess_batch_update_bits(batch, reg, 0xFF, val);
+}
+
+static inline bool ess_batch_bridge(struct ess_batch *batch, u8 *buf,
+				    unsigned int start, unsigned int from,
+				    unsigned int to)
+{
+	unsigned int reg, val;
+
+	if (to - from > ESS_BATCH_MAX_GAP)
+		return false;
+
+	for (reg = from; reg < to; reg++)
+		if (!batch->bridgeable(batch->dev, reg))
+			return false;
+
+	for (reg = from; reg < to; reg++) {
+		if (regmap_read(batch->regmap, reg, &val))
+			return false;
+		buf[reg - start] = val;
+	}
+
+	return true;
+}
+
+/*
+ * Write all staged changes. The staged bits are applied on top of the
+ * current register cache, registers that end up unchanged are skipped.
+ */
+static inline int ess_batch_flush(struct ess_batch *batch)
+{
+	u8 buf[ESS_BATCH_MAX_REGS];
+	unsigned int reg, cur, start = 0, len = 0;
+	u8 new;
+	int ret = 0;
+
+	mutex_lock(&batch->lock);
+	for_each_set_bit(reg, batch->dirty, ESS_BATCH_MAX_REGS) {
+		clear_bit(reg, batch->dirty);
+
+		ret = regmap_read(batch->regmap, reg, &cur);
+		if (ret)
+			break;
+
+		new = (cur & ~batch->mask[reg]) | batch->val[reg];
+		if (new == cur)
+			continue;
+
+		if (len && !ess_batch_bridge(batch, buf, start, start + len,
+					     reg)) {
+			ret = regmap_bulk_write(batch->regmap, start, buf, len);
+			if (ret)
+				break;
+			len = 0;
+		}
+
+		if (!len)
+			start = reg;
+		buf[reg - start] = new;
+		len = reg - start + 1;
+	}
+
+	if (!ret && len)
+		ret = regmap_bulk_write(batch->regmap, start, buf, len);
+
+	if (ret) {
+		dev_err(batch->dev, "register burst failed: %d\n", ret);
+		bitmap_zero(batch->dirty, ESS_BATCH_MAX_REGS);
+	}
+	mutex_unlock(&batch->lock);
+
+	return ret;
+}
+
+/* Flush from a worker, the caller does not wait for the I2C transfers */
+static inline void ess_batch_schedule(struct ess_batch *batch)
+{
+	queue_work(system_highpri_wq, &batch->work);
+}
+
+/*
+ * Wait for a scheduled flush and write anything staged since. Returns the
+ * error of either.
+ */
+static inline int ess_batch_sync(struct ess_batch *batch)
+{
+	int ret;
+
+	flush_work(&batch->work);
+	ret = xchg(&batch->error, 0);
+	if (ret)
+		return ret;
+
+	return ess_batch_flush(batch);
+}
+
+static inline void ess_batch_cancel(struct ess_batch *batch)
+{
+	cancel_work_sync(&batch->work);
+	batch->error = 0;
+}
+
+#endif
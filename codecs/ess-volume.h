@@ -0,0 +1,54 @@
+#ifndef _ESS_VOLUME_H
+#define _ESS_VOLUME_H
+
+/*
+ * High resolution volume for the ESS DACs
+ *
+ * The attenuation registers work in 0.5dB steps. The 32 bit master trim
+ * scales the 0dB level of all channels, so it supplies the 0.01dB steps in
+ * between. A single control covering -127.5dB..0dB in 0.01dB steps is
+ * split into the two here.
+ */
+
+#include <linux/types.h>
+#include <sound/tlv.h>
+
+#define ESS_VOLUME_MAX		12750	/* 0dB, in 0.01dB steps above -127.5dB */
+#define ESS_VOLUME_STEP		50	/* one attenuation register step */
+
+/* Master trim for 0.00dB..-0.49dB: round((2^31 - 1) * 10^(-k / 2000)) */
+static const u32 ess_volume_trim[ESS_VOLUME_STEP] = {
+	0x7fffffff, 0x7fda4bd0, 0x7fb4a2bc, 0x7f8f04bf,
+	0x7f6971d8, 0x7f43ea02, 0x7f1e6d3a, 0x7ef8fb7c,
+	0x7ed394c7, 0x7eae3915, 0x7e88e865, 0x7e63a2b3,
+	0x7e3e67fb, 0x7e19383a, 0x7df4136e, 0x7dcef993,
+	0x7da9eaa5, 0x7d84e6a2, 0x7d5fed86, 0x7d3aff4e,
+	0x7d161bf7, 0x7cf1437e, 0x7ccc75df, 0x7ca7b317,
+	0x7c82fb24, 0x7c5e4e01, 0x7c39abac, 0x7c151421,
+	0x7bf0875e, 0x7bcc055f, 0x7ba78e21, 0x7b8321a0,
+	0x7b5ebfdb, 0x7b3a68cc, 0x7b161c73, 0x7af1daca,
+	0x7acda3cf, 0x7aa9777f, 0x7a8555d7, 0x7a613ed4,
+	0x7a3d3271, 0x7a1930ae, 0x79f53985, 0x79d14cf5,
+	0x79ad6af9, 0x7989938f, 0x7965c6b4, 0x79420465,
+	0x791e4c9e, 0x78fa9f5d,
+};
+
+static const DECLARE_TLV_DB_SCALE(ess_volume_tlv, -12750, 1, 0);
+
+/*
+ * Split a control value into the attenuation register value and the
+ * master trim, little endian as the trim registers expect it.
+ */
+static inline void ess_volume_split(unsigned int value, u8 *atten, u8 trim[4])
+{
+	unsigned int att = ESS_VOLUME_MAX - value;
+	u32 t = ess_volume_trim[att % ESS_VOLUME_STEP];
+
+	*atten = att / ESS_VOLUME_STEP;
+	trim[0] = t & 0xff;
+	trim[1] = (t >> 8) & 0xff;
+	trim[2] = (t >> 16) & 0xff;
+	trim[3] = (t >> 24) & 0xff;
+}
+
+#endif
@@ -13,12 +13,18 @@
 #include <linux/platform_device.h>
 #include <linux/i2c.h>
 #include <linux/of_platform.h>
+#include <linux/firmware.h>
+#include <linux/math64.h>
+#include <linux/workqueue.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
 #include <sound/soc.h>
 #include <sound/pcm_params.h>
 #include <sound/tlv.h>
 #include "sabre32.h"
+#include "ess-batch.h"
+#include "ess-volume.h"
+#include "dsd-rate.h"
 
 /* External module: include config */
 #include <generated/autoconf.h>
@@ -202,17 +208,125 @@ static bool sabre32_writeable_reg(struct device *dev, unsigned int reg)
 
 static bool sabre32_volatile_reg(struct device *dev, unsigned int reg)
 {
-	if( reg <= 0x1F && reg >= 0x1C)
+	if( reg <= 0x1F && reg >= SABRE32_STATUS)
+		return 1;
+	/* FIR coefficient ports: every write loads the next coefficient */
+	else if (reg >= SABRE32_STAGE1_FIR1 && reg <= SABRE32_STAGE2_FIR4)
 		return 1;
 	else return 0;
 }
 
+/* Registers that may be rewritten with their cached value inside a burst */
+static bool sabre32_bridgeable_reg(struct device *dev, unsigned int reg)
+{
+	return sabre32_writeable_reg(dev, reg) && !sabre32_volatile_reg(dev, reg);
+}
+
+/*
+ * Custom FIR coefficient sets, loaded from SABRE32_FIR_FIRMWARE:
+ *
+ * struct sabre32_fir_header, followed by num_sets times
+ * struct sabre32_fir_set_header, each followed by stage1_len and then
+ * stage2_len coefficients as little endian 32 bit words (the order in which
+ * they are written to the coefficient ports). A stage with no coefficients
+ * uses the builtin filter.
+ */
+#define SABRE32_FIR_FIRMWARE		"sabre32-fir.bin"
+#define SABRE32_FIR_MAGIC		"S32F"
+#define SABRE32_FIR_VERSION		1
+#define SABRE32_FIR_NAME_LEN		32
+#define SABRE32_FIR_STAGE1_MAX		128
+#define SABRE32_FIR_STAGE2_MAX		16
+
+struct sabre32_fir_header {
+	char magic[4];
+	u8 version;
+	u8 num_sets;
+	__le16 reserved;
+} __packed;
+
+struct sabre32_fir_set_header {
+	char name[SABRE32_FIR_NAME_LEN];
+	u8 stage1_len;
+	u8 stage2_len;
+	__le16 reserved;
+} __packed;
+
+struct sabre32_fir_set {
+	char name[SABRE32_FIR_NAME_LEN];
+	unsigned int stage1_len;
+	unsigned int stage2_len;
+	/* Raw coefficient bytes, stage 1 then stage 2 */
+	const u8 *coefs;
+};
+
+/*
+ * Output configurations, selected with the "ess,output-mode" DT property.
+ * dac_channel maps each of the eight DACs to the input channel it plays,
+ * which is also the channel whose volume offset applies to it.
+ *
+ * Data line Dn feeds the left and right DAC of pair n. The McASP
+ * interleaves slot-major: with N serializers of two slots, the n-th active
+ * one carries channels n and n + N. data_lines, if set, lists the lines a
+ * PCM stream goes out on when they are not simply the first ones.
+ */
+struct sabre32_mode {
+	const char *name;
+	unsigned int channels;
+	u8 dac_source;	/* DAC_SOURCE bits 7:3: DAC sources, true differential */
+	u8 quantizer;	/* MODE_CONTROL4 */
+	u8 dac_channel[8];
+	unsigned int num_data_lines;
+	const unsigned int *data_lines;
+};
+
+#define SABRE32_DAC_SOURCE_MODE_MASK	0xF8
+
+/* DAC1/2 and DAC5/6 are the only pairs the others can mirror: D1 and D3 */
+static const unsigned int sabre32_4ch_diff_lines[] = { 0, 2 };
+
+static const struct sabre32_mode sabre32_modes[] = {
+	/* Pseudo differential stereo, 9-bit quantizer (default) */
+	{ "stereo",	2, 0x00, 0xFF, { 0, 1, 0, 1, 0, 1, 0, 1 } },
+	/* Four true differential channels: DAC3/4/7/8 mirror DAC1/2/5/6 */
+	{ "4ch-diff",	4, 0xF8, 0x55, { 0, 2, 0, 2, 1, 3, 1, 3 },
+	  ARRAY_SIZE(sabre32_4ch_diff_lines), sabre32_4ch_diff_lines },
+	/* Eight independent channels from four serial data lines */
+	{ "8ch",	8, 0x08, 0x00, { 0, 4, 1, 5, 2, 6, 3, 7 } },
+};
+
 struct sabre32_priv {
 	struct regmap *regmap;
+	struct ess_batch batch;
 	int stream_muted;
 	int dpll_mode;
+	unsigned int volume;
+	const struct sabre32_mode *mode;
+	u8 ch_atten[8]; /* per channel, in 0.5dB steps on top of the master */
+
+	/* Parsed firmware, kept for the lifetime of the device */
+	struct sabre32_fir_set *fir_sets;
+	int num_fir_sets;
+	const char **fir_texts;
+	struct soc_enum fir_enum;
+	int fir_sel; /* 0 is the builtin filter */
+	struct mutex fir_lock; /* serializes uploads against unmuting */
+
+	/* DPLL monitor, polled while a stream is running */
+	struct snd_soc_component *component;
+	struct delayed_work monitor_work;
+	bool monitor_active;
+	unsigned int mclk;
+	unsigned int rate; /* nominal rate of the running stream */
+	int dpll_locked;
+	int dpll_rate;	/* Hz */
+	int dpll_offset; /* ppb against the nominal rate */
 };
 
+#define SABRE32_MONITOR_MS	500
+/* Largest offset reported, anything beyond is a wrong nominal rate */
+#define SABRE32_OFFSET_MAX	100000000
+
 #define SABRE32_FORMATS (\
             SNDRV_PCM_FMTBIT_S16_LE | \
             SNDRV_PCM_FMTBIT_S24_3LE | \
@@ -243,25 +357,25 @@ static int sabre32_dpll_set(struct snd_kcontrol *kcontrol,
 
 	if (value < 2) {
 		/* Set auto or auto 128x */
-		snd_soc_component_update_bits(component, SABRE32_DPLL_MODE, 0x03, 2 + value);
+		ess_batch_update_bits(&sabre32_data->batch, SABRE32_DPLL_MODE, 0x03, 2 + value);
 		/* Reset DPLL bandwidth to default */
-		snd_soc_component_update_bits(component, SABRE32_MODE_CONTROL2, 0x1C, 0x01);
+		ess_batch_update_bits(&sabre32_data->batch, SABRE32_MODE_CONTROL2, 0x1C, 0x01);
 	}
 	else {
 		value -= 2;
 		if (value <= 7) {
-			snd_soc_component_update_bits(component, SABRE32_MODE_CONTROL2, 0x1C, value << 2);
+			ess_batch_update_bits(&sabre32_data->batch, SABRE32_MODE_CONTROL2, 0x1C, value << 2);
 			value = 0;
 		}
 		else {
 			value -= 7;
-			snd_soc_component_update_bits(component, SABRE32_MODE_CONTROL2, 0x1C, value << 2);
+			ess_batch_update_bits(&sabre32_data->batch, SABRE32_MODE_CONTROL2, 0x1C, value << 2);
 			value = 1;
 		}
-		snd_soc_component_update_bits(component, SABRE32_DPLL_MODE, 0x03, value);
+		ess_batch_update_bits(&sabre32_data->batch, SABRE32_DPLL_MODE, 0x03, value);
 	}
 	sabre32_data->dpll_mode = ucontrol->value.enumerated.item[0];
-	return 0;
+	return ess_batch_flush(&sabre32_data->batch);
 }
 
 static int sabre32_dpll_get(struct snd_kcontrol *kcontrol,
@@ -279,18 +393,24 @@ static int sabre32_mute_set(struct snd_kcontrol *kcontrol,
 	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
 	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
 	int value = ucontrol->value.enumerated.item[0];
+	int ret;
 
 	if (value)
 	{
 		sabre32_data->stream_muted = 0;
-		snd_soc_component_update_bits(component, SABRE32_MODE_CONTROL1, 0x01, 0x00);
+		ess_batch_update_bits(&sabre32_data->batch, SABRE32_MODE_CONTROL1, 0x01, 0x00);
 	}
 	else
 	{
 		sabre32_data->stream_muted = 1;
-		snd_soc_component_update_bits(component, SABRE32_MODE_CONTROL1, 0x01, 0x01);
+		ess_batch_update_bits(&sabre32_data->batch, SABRE32_MODE_CONTROL1, 0x01, 0x01);
 	}
-	return 0;
+
+	mutex_lock(&sabre32_data->fir_lock);
+	ret = ess_batch_flush(&sabre32_data->batch);
+	mutex_unlock(&sabre32_data->fir_lock);
+
+	return ret;
 }
 
 static int sabre32_mute_get(struct snd_kcontrol *kcontrol,
@@ -367,10 +487,185 @@ static const char *mclk_notch_text[] = {
 static SOC_ENUM_SINGLE_DECL(mclk_notch, 13, 0, mclk_notch_text);
 */
 
-static const DECLARE_TLV_DB_SCALE(sabre32_dac_tlv, -12750, 50, 0);
+static int sabre32_volume_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+
+	ucontrol->value.integer.value[0] = sabre32_data->volume;
+	return 0;
+}
+
+/* Master and channel attenuation of all eight DACs in one burst */
+static int sabre32_volume_write(struct sabre32_priv *sabre32_data,
+		unsigned int volume)
+{
+	unsigned int master = (ESS_VOLUME_MAX - volume) / ESS_VOLUME_STEP;
+	u8 buf[8];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(buf); i++)
+		buf[i] = min(master + sabre32_data->ch_atten[sabre32_data->mode->dac_channel[i]],
+			     0xFFU);
+
+	return regmap_bulk_write(sabre32_data->regmap, SABRE32_VOLUME0, buf,
+				 sizeof(buf));
+}
+
+/*
+ * The trim registers are always written together as one burst. Going
+ * down the coarse attenuation is written first, going up the trim, so a
+ * change does not pass through an audible step away from the target.
+ * The control only takes the new value once both writes succeeded.
+ */
+static int sabre32_volume_put(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+	unsigned int value = ucontrol->value.integer.value[0];
+	u8 atten, trim[4];
+	int ret;
+
+	if (value > ESS_VOLUME_MAX)
+		return -EINVAL;
+
+	if (value == sabre32_data->volume)
+		return 0;
+
+	ess_volume_split(value, &atten, trim);
+
+	if (value < sabre32_data->volume) {
+		ret = sabre32_volume_write(sabre32_data, value);
+		if (!ret)
+			ret = regmap_bulk_write(sabre32_data->regmap,
+						SABRE32_MASTER_TRIM1,
+						trim, sizeof(trim));
+	} else {
+		ret = regmap_bulk_write(sabre32_data->regmap,
+					SABRE32_MASTER_TRIM1, trim, sizeof(trim));
+		if (!ret)
+			ret = sabre32_volume_write(sabre32_data, value);
+	}
+	if (ret)
+		return ret;
+
+	sabre32_data->volume = value;
+	return 1;
+}
+
+static const DECLARE_TLV_DB_SCALE(sabre32_channel_tlv, -12750, 50, 0);
+
+/* One value per channel of the output mode */
+static int sabre32_channel_volume_info(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_info *uinfo)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = sabre32_data->mode->channels;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = 0xFF;
+	return 0;
+}
+
+static int sabre32_channel_volume_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+	int i;
+
+	for (i = 0; i < sabre32_data->mode->channels; i++)
+		ucontrol->value.integer.value[i] = 0xFF - sabre32_data->ch_atten[i];
+	return 0;
+}
+
+static int sabre32_channel_volume_put(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+	bool changed = false;
+	long value;
+	int i, ret;
+
+	for (i = 0; i < sabre32_data->mode->channels; i++) {
+		value = ucontrol->value.integer.value[i];
+		if (value < 0 || value > 0xFF)
+			return -EINVAL;
+	}
+
+	for (i = 0; i < sabre32_data->mode->channels; i++) {
+		value = 0xFF - ucontrol->value.integer.value[i];
+		if (sabre32_data->ch_atten[i] != value) {
+			sabre32_data->ch_atten[i] = value;
+			changed = true;
+		}
+	}
+
+	if (!changed)
+		return 0;
+
+	ret = sabre32_volume_write(sabre32_data, sabre32_data->volume);
+	if (ret)
+		return ret;
+
+	return 1;
+}
+
+static int sabre32_dpll_info(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = kcontrol->private_value ? -SABRE32_OFFSET_MAX : 0;
+	uinfo->value.integer.max = kcontrol->private_value ? SABRE32_OFFSET_MAX : 1536000;
+	return 0;
+}
+
+static int sabre32_dpll_rate_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+
+	ucontrol->value.integer.value[0] = kcontrol->private_value ?
+		READ_ONCE(sabre32_data->dpll_offset) :
+		READ_ONCE(sabre32_data->dpll_rate);
+	return 0;
+}
+
+static int sabre32_dpll_locked_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+
+	ucontrol->value.integer.value[0] = READ_ONCE(sabre32_data->dpll_locked);
+	return 0;
+}
+
+#define SABRE32_DPLL_CTL(xname, xoffset) \
+{	.iface = SNDRV_CTL_ELEM_IFACE_MIXER, .name = xname, \
+	.access = SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE, \
+	.info = sabre32_dpll_info, .get = sabre32_dpll_rate_get, \
+	.private_value = xoffset }
 
 static const struct snd_kcontrol_new sabre32_controls[] = {
-	SOC_DOUBLE_R_TLV("Master Playback Volume", SABRE32_VOLUME0, SABRE32_VOLUME1, 0, 0xFF, 1, sabre32_dac_tlv),
+	SOC_SINGLE_EXT_TLV("Master Playback Volume", SND_SOC_NOPM, 0, ESS_VOLUME_MAX, 0,
+			   sabre32_volume_get, sabre32_volume_put, ess_volume_tlv),
+	{
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "Channel Playback Volume",
+		.access = SNDRV_CTL_ELEM_ACCESS_READWRITE | SNDRV_CTL_ELEM_ACCESS_TLV_READ,
+		.tlv.p = sabre32_channel_tlv,
+		.info = sabre32_channel_volume_info,
+		.get = sabre32_channel_volume_get,
+		.put = sabre32_channel_volume_put,
+	},
 	SOC_SINGLE_BOOL_EXT("Master Playback Switch", 0, sabre32_mute_get, sabre32_mute_set),
 	SOC_ENUM("SPDIF Source", sabre32_spdif_input),
 	SOC_ENUM("Jitter Reduction", sabre32_jitter_reduction),
@@ -378,6 +673,15 @@ static const struct snd_kcontrol_new sabre32_controls[] = {
 	SOC_ENUM("FIR Rolloff", sabre32_fir_rolloff),
 	SOC_ENUM("DPLL Phase", sabre32_dpll_phase),
 	SOC_ENUM("Oversampling Filter", sabre32_os_filter),
+	{
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "DPLL Locked",
+		.access = SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE,
+		.info = snd_ctl_boolean_mono_info,
+		.get = sabre32_dpll_locked_get,
+	},
+	SABRE32_DPLL_CTL("DPLL Rate", 0),
+	SABRE32_DPLL_CTL("DPLL Offset PPB", 1),
 };
 
 const struct regmap_config sabre32_regmap = {
@@ -393,20 +697,382 @@ const struct regmap_config sabre32_regmap = {
 };
 EXPORT_SYMBOL_GPL(sabre32_regmap);
 
+static int sabre32_fir_write_stage(struct sabre32_priv *sabre32_data,
+		unsigned int port, const u8 *coefs, unsigned int len)
+{
+	unsigned int i;
+	int ret;
+
+	/* One 4 byte burst per coefficient, the port latches on the last byte */
+	for (i = 0; i < len; i++) {
+		ret = regmap_bulk_write(sabre32_data->regmap, port,
+					coefs + 4 * i, 4);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* Called with fir_lock held */
+static int sabre32_fir_upload(struct sabre32_priv *sabre32_data, int sel)
+{
+	struct regmap *regmap = sabre32_data->regmap;
+	const struct sabre32_fir_set *set;
+	unsigned int mode1, prog = 0;
+	int ret;
+
+	regmap_read(regmap, SABRE32_MODE_CONTROL1, &mode1);
+	ret = regmap_update_bits(regmap, SABRE32_MODE_CONTROL1, 0x01, 0x01);
+	if (ret)
+		return ret;
+
+	if (sel > 0) {
+		set = &sabre32_data->fir_sets[sel - 1];
+
+		if (set->stage1_len) {
+			ret = regmap_write(regmap, SABRE32_FIR_PROG_ENABLE, 0x10);
+			if (!ret)
+				ret = sabre32_fir_write_stage(sabre32_data,
+						SABRE32_STAGE1_FIR1, set->coefs,
+						set->stage1_len);
+			if (ret)
+				goto out;
+			prog |= 0x20;
+		}
+
+		if (set->stage2_len) {
+			ret = regmap_write(regmap, SABRE32_FIR_PROG_ENABLE, 0x01);
+			if (!ret)
+				ret = sabre32_fir_write_stage(sabre32_data,
+						SABRE32_STAGE2_FIR1,
+						set->coefs + 4 * set->stage1_len,
+						set->stage2_len);
+			if (ret)
+				goto out;
+			prog |= 0x02;
+		}
+	}
+
+out:
+	/* Close the coefficient ports, select custom or builtin filters */
+	if (ret)
+		prog = 0;
+	regmap_write(regmap, SABRE32_FIR_PROG_ENABLE, prog);
+	regmap_update_bits(regmap, SABRE32_MODE_CONTROL1, 0x01, mode1);
+
+	return ret;
+}
+
+static int sabre32_fir_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+
+	ucontrol->value.enumerated.item[0] = sabre32_data->fir_sel;
+	return 0;
+}
+
+static int sabre32_fir_put(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+	unsigned int sel = ucontrol->value.enumerated.item[0];
+	int ret;
+
+	if (sel > sabre32_data->num_fir_sets)
+		return -EINVAL;
+
+	mutex_lock(&sabre32_data->fir_lock);
+	if (sel == sabre32_data->fir_sel) {
+		mutex_unlock(&sabre32_data->fir_lock);
+		return 0;
+	}
+
+	ret = sabre32_fir_upload(sabre32_data, sel);
+	sabre32_data->fir_sel = ret ? 0 : sel;
+	mutex_unlock(&sabre32_data->fir_lock);
+
+	if (ret) {
+		dev_err(component->dev, "FIR upload failed: %d\n", ret);
+		return ret;
+	}
+
+	return 1;
+}
+
+static int sabre32_fir_parse(struct device *dev,
+		struct sabre32_priv *sabre32_data, const struct firmware *fw)
+{
+	const struct sabre32_fir_header *hdr = (const void *)fw->data;
+	const struct sabre32_fir_set_header *shdr;
+	struct sabre32_fir_set *sets;
+	const char **texts;
+	size_t pos = sizeof(*hdr), len;
+	int i;
+
+	if (fw->size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, SABRE32_FIR_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != SABRE32_FIR_VERSION || !hdr->num_sets) {
+		dev_err(dev, "invalid %s\n", SABRE32_FIR_FIRMWARE);
+		return -EINVAL;
+	}
+
+	sets = devm_kcalloc(dev, hdr->num_sets, sizeof(*sets), GFP_KERNEL);
+	texts = devm_kcalloc(dev, hdr->num_sets + 1, sizeof(*texts), GFP_KERNEL);
+	if (!sets || !texts)
+		return -ENOMEM;
+
+	texts[0] = "Builtin";
+	for (i = 0; i < hdr->num_sets; i++) {
+		if (fw->size - pos < sizeof(*shdr))
+			goto truncated;
+		shdr = (const void *)(fw->data + pos);
+		pos += sizeof(*shdr);
+
+		if (shdr->stage1_len > SABRE32_FIR_STAGE1_MAX ||
+		    shdr->stage2_len > SABRE32_FIR_STAGE2_MAX) {
+			dev_err(dev, "FIR set %d has too many coefficients\n", i);
+			return -EINVAL;
+		}
+
+		len = 4 * (shdr->stage1_len + shdr->stage2_len);
+		if (fw->size - pos < len)
+			goto truncated;
+
+		strscpy(sets[i].name, shdr->name, sizeof(sets[i].name));
+		sets[i].stage1_len = shdr->stage1_len;
+		sets[i].stage2_len = shdr->stage2_len;
+		sets[i].coefs = devm_kmemdup(dev, fw->data + pos, len, GFP_KERNEL);
+		if (len && !sets[i].coefs)
+			return -ENOMEM;
+		texts[i + 1] = sets[i].name;
+		pos += len;
+	}
+
+	sabre32_data->fir_sets = sets;
+	sabre32_data->fir_texts = texts;
+	sabre32_data->num_fir_sets = hdr->num_sets;
+
+	return 0;
+
+truncated:
+	dev_err(dev, "%s is truncated\n", SABRE32_FIR_FIRMWARE);
+	return -EINVAL;
+}
+
+/*
+ * Load and parse the coefficient sets once; the parsed copy survives card
+ * rebinds, so re-probing the component does not fetch the file again.
+ */
+static int sabre32_fir_init(struct snd_soc_component *component)
+{
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+	struct snd_kcontrol_new ctl = {
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "FIR Filter",
+		.info = snd_soc_info_enum_double,
+		.get = sabre32_fir_get,
+		.put = sabre32_fir_put,
+	};
+	const struct firmware *fw;
+	int ret;
+
+	if (!sabre32_data->fir_sets) {
+		if (firmware_request_nowarn(&fw, SABRE32_FIR_FIRMWARE,
+					    component->dev))
+			return 0;
+
+		ret = sabre32_fir_parse(component->dev, sabre32_data, fw);
+		release_firmware(fw);
+		if (ret)
+			return 0;
+
+		sabre32_data->fir_enum.items = sabre32_data->num_fir_sets + 1;
+		sabre32_data->fir_enum.texts = sabre32_data->fir_texts;
+	}
+
+	/* The selection does not survive the DAC being reconfigured */
+	sabre32_data->fir_sel = 0;
+	ctl.private_value = (unsigned long)&sabre32_data->fir_enum;
+
+	return snd_soc_add_component_controls(component, &ctl, 1);
+}
+
+static void sabre32_monitor_notify(struct sabre32_priv *sabre32_data,
+		const char *name)
+{
+	struct snd_kcontrol *kctl;
+
+	kctl = snd_soc_component_get_kcontrol(sabre32_data->component, name);
+	if (kctl)
+		snd_ctl_notify(sabre32_data->component->card->snd_card,
+			       SNDRV_CTL_EVENT_MASK_VALUE, &kctl->id);
+}
+
+/* Nothing is locked once the stream stopped */
+static void sabre32_monitor_reset(struct sabre32_priv *sabre32_data)
+{
+	WRITE_ONCE(sabre32_data->dpll_offset, 0);
+
+	if (sabre32_data->dpll_locked) {
+		WRITE_ONCE(sabre32_data->dpll_locked, 0);
+		sabre32_monitor_notify(sabre32_data, "DPLL Locked");
+	}
+
+	if (sabre32_data->dpll_rate) {
+		WRITE_ONCE(sabre32_data->dpll_rate, 0);
+		sabre32_monitor_notify(sabre32_data, "DPLL Rate");
+	}
+}
+
+/*
+ * STATUS and DPLL_NUM1-4 are read in one burst. DPLL_NUM is the ratio of
+ * the incoming sample rate to MCLK as a 32 bit fraction, so the rate is
+ * DPLL_NUM * MCLK / 2^32.
+ */
+static void sabre32_monitor_work(struct work_struct *work)
+{
+	struct sabre32_priv *sabre32_data =
+		container_of(work, struct sabre32_priv, monitor_work.work);
+	unsigned int rate = READ_ONCE(sabre32_data->rate);
+	u8 buf[5];
+	u32 num;
+	u64 rate_millihz;
+	s64 offset = 0;
+	int locked;
+
+	if (!READ_ONCE(sabre32_data->monitor_active)) {
+		sabre32_monitor_reset(sabre32_data);
+		return;
+	}
+
+	if (regmap_bulk_read(sabre32_data->regmap, SABRE32_STATUS, buf,
+			     sizeof(buf)))
+		goto out;
+
+	locked = buf[0] & 0x01;
+	num = buf[1] | (buf[2] << 8) | (buf[3] << 16) | ((u32)buf[4] << 24);
+	rate_millihz = mul_u64_u32_shr((u64)num * 1000, sabre32_data->mclk, 32);
+
+	if (locked && rate) {
+		offset = div_s64(((s64)rate_millihz - (s64)rate * 1000) * 1000000,
+				 rate);
+		offset = clamp_t(s64, offset, -SABRE32_OFFSET_MAX,
+				 SABRE32_OFFSET_MAX);
+	}
+
+	WRITE_ONCE(sabre32_data->dpll_offset, offset);
+
+	if (locked != sabre32_data->dpll_locked) {
+		WRITE_ONCE(sabre32_data->dpll_locked, locked);
+		if (!locked)
+			dev_warn_ratelimited(sabre32_data->component->dev,
+					     "DPLL lost lock\n");
+		sabre32_monitor_notify(sabre32_data, "DPLL Locked");
+	}
+
+	if (locked && (int)div_u64(rate_millihz, 1000) != sabre32_data->dpll_rate) {
+		WRITE_ONCE(sabre32_data->dpll_rate, div_u64(rate_millihz, 1000));
+		sabre32_monitor_notify(sabre32_data, "DPLL Rate");
+	}
+
+out:
+	if (READ_ONCE(sabre32_data->monitor_active))
+		schedule_delayed_work(&sabre32_data->monitor_work,
+				      msecs_to_jiffies(SABRE32_MONITOR_MS));
+}
+
 static int sabre32_component_probe(struct snd_soc_component *component)
 {
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+	int ret;
+
+	sabre32_data->component = component;
+
 	/* Setup some default register settings */
 	
-	/* Set pseudo differential */
-	snd_soc_component_update_bits(component, SABRE32_DAC_SOURCE, 0x08, 0x00);
-	/* Set 9-bit quantizer for stereo */
-	snd_soc_component_write(component, SABRE32_MODE_CONTROL4, 0xFF);
+	/* DAC sources, differential mode and quantizer of the output mode */
+	ess_batch_update_bits(&sabre32_data->batch, SABRE32_DAC_SOURCE,
+			      SABRE32_DAC_SOURCE_MODE_MASK, sabre32_data->mode->dac_source);
+	ess_batch_write(&sabre32_data->batch, SABRE32_MODE_CONTROL4, sabre32_data->mode->quantizer);
+	/* Builtin FIR filters until one is selected */
+	ess_batch_write(&sabre32_data->batch, SABRE32_FIR_PROG_ENABLE, 0x00);
+	ret = ess_batch_flush(&sabre32_data->batch);
+	if (ret)
+		return ret;
+
+	return sabre32_fir_init(component);
+}
+
+static void sabre32_component_remove(struct snd_soc_component *component)
+{
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+
+	WRITE_ONCE(sabre32_data->monitor_active, false);
+	cancel_delayed_work_sync(&sabre32_data->monitor_work);
+	ess_batch_cancel(&sabre32_data->batch);
+}
+
+#ifdef CONFIG_PM
+/*
+ * The DAC is powered down by the card, keep the registers in the cache and
+ * let regcache_sync() write back the non-default ones in bursts.
+ */
+static int sabre32_component_suspend(struct snd_soc_component *component)
+{
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+
+	ess_batch_cancel(&sabre32_data->batch);
+	regcache_cache_only(sabre32_data->regmap, true);
+	regcache_mark_dirty(sabre32_data->regmap);
+
 	return 0;
 }
 
+static int sabre32_component_resume(struct snd_soc_component *component)
+{
+	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+	int ret;
+
+	regcache_cache_only(sabre32_data->regmap, false);
+	ret = regcache_sync(sabre32_data->regmap);
+	if (ret) {
+		dev_err(component->dev, "failed to restore registers: %d\n", ret);
+		return ret;
+	}
+
+	/* Anything staged while suspended */
+	ret = ess_batch_flush(&sabre32_data->batch);
+	if (ret)
+		return ret;
+
+	/* The coefficient RAM is not cached, load the selected set again */
+	mutex_lock(&sabre32_data->fir_lock);
+	if (sabre32_data->fir_sel) {
+		ret = sabre32_fir_upload(sabre32_data, sabre32_data->fir_sel);
+		if (ret) {
+			dev_err(component->dev, "FIR upload failed: %d\n", ret);
+			sabre32_data->fir_sel = 0;
+		}
+	}
+	mutex_unlock(&sabre32_data->fir_lock);
+
+	return ret;
+}
+#else
+#define sabre32_component_suspend NULL
+#define sabre32_component_resume NULL
+#endif
+
 static struct snd_soc_component_driver sabre32_component_driver = {
     .controls = sabre32_controls,
     .probe = sabre32_component_probe,
+    .remove = sabre32_component_remove,
+    .suspend = sabre32_component_suspend,
+    .resume = sabre32_component_resume,
     .num_controls = ARRAY_SIZE(sabre32_controls),
     .idle_bias_on = 1,
     .use_pmdown_time = 1,
@@ -414,19 +1080,24 @@ static struct snd_soc_component_driver sabre32_component_driver = {
     .legacy_dai_naming = 1,
 };
 
+/*
+ * Only staged, the change goes out together with the hw_params or mute
+ * update of the same register.
+ */
 static int sabre32_set_fmt(struct snd_soc_dai *dai, unsigned int fmt)
 {
     struct snd_soc_component *component = dai->component;
+    struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
 
     switch (fmt & SND_SOC_DAIFMT_FORMAT_MASK) {
     case SND_SOC_DAIFMT_I2S:
-        snd_soc_component_update_bits(component, SABRE32_MODE_CONTROL1, 0x30, 0x00);
+        ess_batch_update_bits(&sabre32_data->batch, SABRE32_MODE_CONTROL1, 0x30, 0x00);
         break;
     case SND_SOC_DAIFMT_LEFT_J:
-        snd_soc_component_update_bits(component, SABRE32_MODE_CONTROL1, 0x30, 0x10);
+        ess_batch_update_bits(&sabre32_data->batch, SABRE32_MODE_CONTROL1, 0x30, 0x10);
         break;
     case SND_SOC_DAIFMT_RIGHT_J:
-        snd_soc_component_update_bits(component, SABRE32_MODE_CONTROL1, 0x30, 0x20);
+        ess_batch_update_bits(&sabre32_data->batch, SABRE32_MODE_CONTROL1, 0x30, 0x20);
         break;
     default:
         dev_warn(component->dev, "unsupported DAI fmt %d", fmt);
@@ -441,6 +1112,7 @@ static int sabre32_mute(struct snd_soc_dai *dai, int mute, int stream)
 {
 	struct snd_soc_component *component = dai->component;
 	struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+	int ret;
 
 	if(stream != SNDRV_PCM_STREAM_PLAYBACK)
 		return 0;
@@ -449,40 +1121,59 @@ static int sabre32_mute(struct snd_soc_dai *dai, int mute, int stream)
 	if(!mute)
 		mute = sabre32_data->stream_muted;
 
-	snd_soc_component_update_bits(component, SABRE32_MODE_CONTROL1, 0x01, mute ? 0x01 : 0x00);
+	/* Stay muted while FIR coefficients are being loaded */
+	mutex_lock(&sabre32_data->fir_lock);
+	ess_batch_update_bits(&sabre32_data->batch, SABRE32_MODE_CONTROL1, 0x01, mute ? 0x01 : 0x00);
+	ret = ess_batch_flush(&sabre32_data->batch);
+	mutex_unlock(&sabre32_data->fir_lock);
 
-	return 0;
+	return ret;
+}
+
+#define SABRE32_PCM_RATE_MAX	768000
+
+static int sabre32_startup(struct snd_pcm_substream *substream,
+		struct snd_soc_dai *dai)
+{
+	return dsd_rate_constrain(substream->runtime, SABRE32_PCM_RATE_MAX);
 }
 
 static int sabre32_hw_params(struct snd_pcm_substream *substream,
         struct snd_pcm_hw_params *params, struct snd_soc_dai *dai)
 {
     struct snd_soc_component *component = dai->component;
+    struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(component);
+    struct ess_batch *batch = &sabre32_data->batch;
+    const struct sabre32_mode *mode = sabre32_data->mode;
+    unsigned int num_lines = 0;
+    bool dsd = false;
+    int ret;
 
     switch (params_format(params)) {
     case SNDRV_PCM_FORMAT_S16_LE:
 	    /* set bit depth */
-	    snd_soc_component_update_bits(component, SABRE32_MODE_CONTROL1, 0xc0, 0x80);
+	    ess_batch_update_bits(batch, SABRE32_MODE_CONTROL1, 0xc0, 0x80);
 	    /* set IIR bandwidth to Normal */
-	    snd_soc_component_update_bits(component, SABRE32_DAC_SOURCE, 0x06, 0x00);
+	    ess_batch_update_bits(batch, SABRE32_DAC_SOURCE, 0x06, 0x00);
 	    break;
 
     case SNDRV_PCM_FORMAT_S24_3LE:
     case SNDRV_PCM_FORMAT_S24_LE:
-        snd_soc_component_update_bits(component, SABRE32_MODE_CONTROL1, 0xc0, 0x00);
-        snd_soc_component_update_bits(component, SABRE32_DAC_SOURCE, 0x06, 0x00);
+        ess_batch_update_bits(batch, SABRE32_MODE_CONTROL1, 0xc0, 0x00);
+        ess_batch_update_bits(batch, SABRE32_DAC_SOURCE, 0x06, 0x00);
 	break;
 
     case SNDRV_PCM_FORMAT_S32_LE:
-	snd_soc_component_update_bits(component, SABRE32_MODE_CONTROL1, 0xc0, 0xc0);
-	snd_soc_component_update_bits(component, SABRE32_DAC_SOURCE, 0x06, 0x00);
+	ess_batch_update_bits(batch, SABRE32_MODE_CONTROL1, 0xc0, 0xc0);
+	ess_batch_update_bits(batch, SABRE32_DAC_SOURCE, 0x06, 0x00);
 	break;
     case SNDRV_PCM_FORMAT_DSD_U8:
     case SNDRV_PCM_FORMAT_DSD_U16_LE:
     case SNDRV_PCM_FORMAT_DSD_U32_LE:
-        snd_soc_component_update_bits(component, SABRE32_MODE_CONTROL1, 0xc0, 0xc0);
+        ess_batch_update_bits(batch, SABRE32_MODE_CONTROL1, 0xc0, 0xc0);
 	/* set IIR bandwidth to 60k */
-	snd_soc_component_update_bits(component, SABRE32_DAC_SOURCE, 0x06, 0x04);
+	ess_batch_update_bits(batch, SABRE32_DAC_SOURCE, 0x06, 0x04);
+	dsd = true;
         break;
 
     default:
@@ -490,13 +1181,87 @@ static int sabre32_hw_params(struct snd_pcm_substream *substream,
         return -EINVAL;
     }
 
+    /* Route PCM to the data lines of the mode, DSD keeps one per channel */
+    if (mode->data_lines) {
+	    if (!dsd)
+		    num_lines = min(DIV_ROUND_UP(params_channels(params), 2),
+				    mode->num_data_lines);
+	    ret = snd_soc_dai_set_channel_map(
+			snd_soc_rtd_to_cpu(snd_soc_substream_to_rtd(substream), 0),
+			num_lines, mode->data_lines, 0, NULL);
+	    if (ret) {
+		    dev_err(component->dev, "Failed to route the data lines: %d\n", ret);
+		    return ret;
+	    }
+    }
+
+    WRITE_ONCE(sabre32_data->rate, params_rate(params));
+
+    /*
+     * Includes a pending DAI format change of MODE_CONTROL1. Written in the
+     * background while the CPU DAI is set up, prepare waits for it.
+     */
+    ess_batch_schedule(batch);
+
+    return 0;
+}
+
+static int sabre32_prepare(struct snd_pcm_substream *substream,
+        struct snd_soc_dai *dai)
+{
+    struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(dai->component);
+
+    return ess_batch_sync(&sabre32_data->batch);
+}
+
+static int sabre32_set_sysclk(struct snd_soc_dai *dai, int clk_id,
+        unsigned int freq, int dir)
+{
+    struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(dai->component);
+
+    sabre32_data->mclk = freq;
+    return 0;
+}
+
+/* Atomic context: only (re)arm the monitor, the work does the I2C reads */
+static int sabre32_trigger(struct snd_pcm_substream *substream, int cmd,
+        struct snd_soc_dai *dai)
+{
+    struct sabre32_priv *sabre32_data = snd_soc_component_get_drvdata(dai->component);
+
+    /* Without MCLK the DPLL ratio means nothing */
+    if (!sabre32_data->mclk)
+        return 0;
+
+    switch (cmd) {
+    case SNDRV_PCM_TRIGGER_START:
+    case SNDRV_PCM_TRIGGER_RESUME:
+    case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+        WRITE_ONCE(sabre32_data->monitor_active, true);
+        /* Give the DPLL time to acquire lock before the first read */
+        mod_delayed_work(system_wq, &sabre32_data->monitor_work,
+                         msecs_to_jiffies(SABRE32_MONITOR_MS));
+        break;
+    case SNDRV_PCM_TRIGGER_STOP:
+    case SNDRV_PCM_TRIGGER_SUSPEND:
+    case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
+        WRITE_ONCE(sabre32_data->monitor_active, false);
+        /* The work clears the readings and notifies, not atomic here */
+        mod_delayed_work(system_wq, &sabre32_data->monitor_work, 0);
+        break;
+    }
+
     return 0;
 }
 
 static const struct snd_soc_dai_ops sabre32_dai_ops = {
+    .startup = sabre32_startup,
     .set_fmt = sabre32_set_fmt,
+    .set_sysclk = sabre32_set_sysclk,
     .mute_stream = sabre32_mute,
     .hw_params = sabre32_hw_params,
+    .prepare = sabre32_prepare,
+    .trigger = sabre32_trigger,
 };
 
 static struct snd_soc_dai_driver sabre32_dai = {
@@ -505,7 +1270,9 @@ static struct snd_soc_dai_driver sabre32_dai = {
 		.stream_name = "Playback",
 		.channels_min = 1,
 		.channels_max = 2,
-		.rates = SNDRV_PCM_RATE_8000_768000,
+		.rate_min = 8000,
+		.rate_max = DSD_RATE_MAX,
+		.rates = SNDRV_PCM_RATE_KNOT,
 		.formats = SABRE32_FORMATS,
 	},
 	.ops = &sabre32_dai_ops,
@@ -514,7 +1281,9 @@ static struct snd_soc_dai_driver sabre32_dai = {
 int sabre32_probe(struct device *dev, struct regmap *regmap)
 {
 	struct sabre32_priv *sabre32;
-	int ret = 0;
+	struct snd_soc_dai_driver *dai;
+	const char *mode = "stereo";
+	int i, ret = 0;
 
 	sabre32 = devm_kzalloc(dev, sizeof(struct sabre32_priv), GFP_KERNEL);
 	if (!sabre32)
@@ -522,10 +1291,29 @@ int sabre32_probe(struct device *dev, struct regmap *regmap)
 	dev_set_drvdata(dev, sabre32);
 	/* Initialize internal data */
 	sabre32->regmap = regmap;
+	ess_batch_init(&sabre32->batch, dev, regmap, sabre32_bridgeable_reg);
+	mutex_init(&sabre32->fir_lock);
+	INIT_DELAYED_WORK(&sabre32->monitor_work, sabre32_monitor_work);
 	sabre32->stream_muted = 0;
 	sabre32->dpll_mode = 0;
+	sabre32->volume = ESS_VOLUME_MAX;
+
+	device_property_read_string(dev, "ess,output-mode", &mode);
+	for (i = 0; i < ARRAY_SIZE(sabre32_modes); i++)
+		if (!strcmp(mode, sabre32_modes[i].name))
+			sabre32->mode = &sabre32_modes[i];
+	if (!sabre32->mode) {
+		dev_err(dev, "unknown output mode %s\n", mode);
+		return -EINVAL;
+	}
+
+	/* Channel count depends on the output mode */
+	dai = devm_kmemdup(dev, &sabre32_dai, sizeof(sabre32_dai), GFP_KERNEL);
+	if (!dai)
+		return -ENOMEM;
+	dai->playback.channels_max = sabre32->mode->channels;
 
-	ret = devm_snd_soc_register_component(dev, &sabre32_component_driver, &sabre32_dai, 1);
+	ret = devm_snd_soc_register_component(dev, &sabre32_component_driver, dai, 1);
 	
 	if (ret != 0) {
 		dev_err(dev, "Failed to register CODEC: %d\n", ret);
@@ -581,3 +1369,4 @@ MODULE_AUTHOR("Christian Kroener");
 MODULE_DESCRIPTION("ESS Technology Sabre32 Audio DAC");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS("platform:asoc-sabre32-codec");
+MODULE_FIRMWARE(SABRE32_FIR_FIRMWARE);
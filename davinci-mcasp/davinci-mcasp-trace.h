@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * ALSA SoC McASP Audio Layer for TI DAVINCI processor
+ *
+ * Tracepoints for the McASP data path
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM davinci_mcasp
+
+#if !defined(_DAVINCI_MCASP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _DAVINCI_MCASP_TRACE_H
+
+#include <linux/device.h>
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(mcasp_stream,
+
+	TP_PROTO(struct device *dev, int streams),
+
+	TP_ARGS(dev, streams),
+
+	TP_STRUCT__entry(
+		__string(	name,		dev_name(dev)	)
+		__field(	int,		streams		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name);
+		__entry->streams = streams;
+	),
+
+	TP_printk("%s streams=%d", __get_str(name), __entry->streams)
+);
+
+DEFINE_EVENT(mcasp_stream, mcasp_start_tx,
+
+	TP_PROTO(struct device *dev, int streams),
+
+	TP_ARGS(dev, streams)
+);
+
+DEFINE_EVENT(mcasp_stream, mcasp_start_rx,
+
+	TP_PROTO(struct device *dev, int streams),
+
+	TP_ARGS(dev, streams)
+);
+
+DEFINE_EVENT(mcasp_stream, mcasp_stop_tx,
+
+	TP_PROTO(struct device *dev, int streams),
+
+	TP_ARGS(dev, streams)
+);
+
+DEFINE_EVENT(mcasp_stream, mcasp_stop_rx,
+
+	TP_PROTO(struct device *dev, int streams),
+
+	TP_ARGS(dev, streams)
+);
+
+TRACE_EVENT(mcasp_xrun,
+
+	TP_PROTO(struct device *dev, int stream, u32 stat),
+
+	TP_ARGS(dev, stream, stat),
+
+	TP_STRUCT__entry(
+		__string(	name,		dev_name(dev)	)
+		__field(	int,		stream		)
+		__field(	u32,		stat		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name);
+		__entry->stream = stream;
+		__entry->stat = stat;
+	),
+
+	TP_printk("%s %s stat=0x%08x", __get_str(name),
+		  __entry->stream ? "overrun" : "underrun", __entry->stat)
+);
+
+TRACE_EVENT(mcasp_fifo_level,
+
+	TP_PROTO(struct device *dev, int stream, u32 level),
+
+	TP_ARGS(dev, stream, level),
+
+	TP_STRUCT__entry(
+		__string(	name,		dev_name(dev)	)
+		__field(	int,		stream		)
+		__field(	u32,		level		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name);
+		__entry->stream = stream;
+		__entry->level = level;
+	),
+
+	TP_printk("%s %s level=%u", __get_str(name),
+		  __entry->stream ? "rx" : "tx", __entry->level)
+);
+
+TRACE_EVENT(mcasp_dma_burst,
+
+	TP_PROTO(struct device *dev, int stream, int period_words,
+		 int serializers, int numevt, u32 maxburst),
+
+	TP_ARGS(dev, stream, period_words, serializers, numevt, maxburst),
+
+	TP_STRUCT__entry(
+		__string(	name,		dev_name(dev)	)
+		__field(	int,		stream		)
+		__field(	int,		period_words	)
+		__field(	int,		serializers	)
+		__field(	int,		numevt		)
+		__field(	u32,		maxburst	)
+	),
+
+	TP_fast_assign(
+		__assign_str(name);
+		__entry->stream = stream;
+		__entry->period_words = period_words;
+		__entry->serializers = serializers;
+		__entry->numevt = numevt;
+		__entry->maxburst = maxburst;
+	),
+
+	TP_printk("%s %s period_words=%d serializers=%d numevt=%d maxburst=%u",
+		  __get_str(name), __entry->stream ? "rx" : "tx",
+		  __entry->period_words, __entry->serializers,
+		  __entry->numevt, __entry->maxburst)
+);
+
+#endif /* _DAVINCI_MCASP_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE davinci-mcasp-trace
+#include <trace/define_trace.h>
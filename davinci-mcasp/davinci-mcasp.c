@@ -27,6 +27,12 @@
 #include <linux/math64.h>
 #include <linux/bitmap.h>
 #include <linux/gpio/driver.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/iopoll.h>
+#include <linux/regmap.h>
+#include <linux/workqueue.h>
+#include <linux/spinlock.h>
 
 #include <sound/asoundef.h>
 #include <sound/core.h>
@@ -44,43 +50,120 @@
 #include "udma-pcm.h"
 #include "davinci-mcasp.h"
 
+#define CREATE_TRACE_POINTS
+#include "davinci-mcasp-trace.h"
+
 #define MCASP_MAX_AFIFO_DEPTH	64
+#define MCASP_FIFO_HIST_BUCKETS	8
 
-#ifdef CONFIG_PM
-static u32 context_regs[] = {
-	DAVINCI_MCASP_TXFMCTL_REG,
-	DAVINCI_MCASP_RXFMCTL_REG,
-	DAVINCI_MCASP_TXFMT_REG,
-	DAVINCI_MCASP_RXFMT_REG,
-	DAVINCI_MCASP_ACLKXCTL_REG,
-	DAVINCI_MCASP_ACLKRCTL_REG,
-	DAVINCI_MCASP_AHCLKXCTL_REG,
-	DAVINCI_MCASP_AHCLKRCTL_REG,
-	DAVINCI_MCASP_PDIR_REG,
-	DAVINCI_MCASP_PFUNC_REG,
-	DAVINCI_MCASP_RXMASK_REG,
-	DAVINCI_MCASP_TXMASK_REG,
-	DAVINCI_MCASP_RXTDM_REG,
-	DAVINCI_MCASP_TXTDM_REG,
+/* Upper bound for the TX serializers to request their first data */
+#define MCASP_XRDATA_TIMEOUT_US	200
+
+/* DMA events per second the "Auto" AFIFO policy aims for */
+#define MCASP_AUTO_DMA_EVENT_RATE	12000
+
+enum davinci_mcasp_numevt_policy {
+	MCASP_NUMEVT_DEFAULT = 0,	/* tx/rx-num-evt from DT */
+	MCASP_NUMEVT_MIN_LATENCY,	/* one word per serializer */
+	MCASP_NUMEVT_MIN_DMA_EVENTS,	/* up to MCASP_MAX_AFIFO_DEPTH */
+	MCASP_NUMEVT_AUTO,		/* scaled by rate and channels */
 };
 
-struct davinci_mcasp_context {
-	u32	config_regs[ARRAY_SIZE(context_regs)];
-	u32	afifo_regs[2]; /* for read/write fifo control registers */
-	u32	*xrsr_regs; /* for serializer configuration */
-	bool	pm_state;
+static int numevt_policy = MCASP_NUMEVT_DEFAULT;
+module_param(numevt_policy, int, 0644);
+MODULE_PARM_DESC(numevt_policy, "Default AFIFO burst policy "
+		 "(0=DT value, 1=min latency, 2=min DMA events, 3=auto)");
+
+static unsigned int clock_keepalive_ms;
+module_param(clock_keepalive_ms, uint, 0644);
+MODULE_PARM_DESC(clock_keepalive_ms, "Keep BCLK/LRCLK running for this long "
+		 "after playback stops, unless set by DT (0=off)");
+
+
+/*
+ * Per direction statistics. Updated from the IRQ handlers, the trigger and
+ * the .delay callback without taking any lock; readers only ever see a
+ * consistent value per counter, which is all debugfs needs.
+ */
+struct davinci_mcasp_stats {
+	atomic_t	xruns;
+	atomic_t	triggers;
+	atomic_t	fifo_samples;
+	atomic_t	fifo_min;
+	atomic_t	fifo_max;
+	atomic_t	fifo_hist[MCASP_FIFO_HIST_BUCKETS];
+	/* Playback only: wait for XRDATA to clear in mcasp_start_tx() */
+	u32		start_wait_ns;
+	u32		start_wait_max_ns;
+	atomic_t	start_timeouts;
 };
-#endif
 
 struct davinci_mcasp_ruledata {
 	struct davinci_mcasp *mcasp;
 	int serializers;
 };
 
+/* Up to DSD1024 as DSD_U32 frames: one bit per BCLK in burst mode */
+static const unsigned int davinci_mcasp_dai_rates[] = {
+	8000, 11025, 16000, 22050, 32000, 44100, 48000, 64000,
+	88200, 96000, 176400, 192000, 352800, 384000, 705600, 768000,
+	1411200, 1536000,
+};
+
+#define DAVINCI_MCASP_RATE_MAX	1536000
+
+static const struct snd_pcm_hw_constraint_list davinci_mcasp_rate_constraint = {
+	.count = ARRAY_SIZE(davinci_mcasp_dai_rates),
+	.list = davinci_mcasp_dai_rates,
+};
+
+#define DAVINCI_MCASP_NUM_RATES	ARRAY_SIZE(davinci_mcasp_dai_rates)
+/* Slot widths 8, 16, 24 and 32 */
+#define MCASP_CLKDIV_WIDTHS	4
+
+struct davinci_mcasp_clkdiv {
+	int	bclk_div;
+	int	aux_div;
+	int	error_ppm;
+	bool	ahclk;	/* AHCLKX in use, aux_div applies */
+};
+
+/* Largest number of McASPs whose TX sections start together */
+#define MCASP_GROUP_MAX		4
+/* Longest an armed member waits for the streams linked with it */
+#define MCASP_GROUP_TIMEOUT_MS	20
+
+/*
+ * McASPs started on the same frame sync edge. The leader, member 0,
+ * provides BCLK and FS, the others run as clock slaves on its pins; the
+ * TX state machines of all members are released in one sequence, the
+ * leader's frame sync generator last.
+ *
+ * Every member keeps its own PCM and DMA channel. Presenting them as one
+ * wide PCM would need a platform driver that splits each frame across
+ * the members' DMA channels, which edma-pcm can not do; the members'
+ * streams have to be joined with snd_pcm_link() instead.
+ *
+ * Each member unbinds on its own, so the group is not owned by any of
+ * them: members leave by clearing their slot and the last one frees it.
+ * mcasp_group_lock protects the groups and the members' group pointers.
+ */
+struct davinci_mcasp_group {
+	int num_members;
+	struct davinci_mcasp *members[MCASP_GROUP_MAX]; /* NULL once left */
+	unsigned long present;
+	unsigned long armed;	/* ready, waiting for the others */
+	unsigned long running;
+	struct timer_list timeout;
+};
+
+static DEFINE_SPINLOCK(mcasp_group_lock);
+
 struct davinci_mcasp {
 	struct snd_dmaengine_dai_dma_data dma_data[2];
 	struct davinci_mcasp_pdata *pdata;
 	void __iomem *base;
+	struct regmap *regmap;
 	u32 fifo_base;
 	struct device *dev;
 	struct snd_pcm_substream *substreams[2];
@@ -112,6 +195,8 @@ struct davinci_mcasp {
 	/* McASP FIFO related */
 	u8	txnumevt;
 	u8	rxnumevt;
+	int	numevt_policy;
+	u8	cur_numevt[2]; /* as programmed by the last hw_params */
 
 	bool	dat_port;
 
@@ -119,49 +204,123 @@ struct davinci_mcasp {
 	u32	channels;
 	int	max_format_width;
 	u8	active_serializers[2];
+	u32	tx_lines;	/* TX serializers in use by position, 0: the first */
 
 #ifdef CONFIG_GPIOLIB
 	struct gpio_chip gpio_chip;
 #endif
 
-#ifdef CONFIG_PM
-	struct davinci_mcasp_context context;
-#endif
-
 	struct davinci_mcasp_ruledata ruledata[2];
 	struct snd_pcm_hw_constraint_list chconstr[2];
+
+	struct davinci_mcasp_stats stats[2];
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *debugfs;
+#endif
+
+	/*
+	 * BCLK/AUXCLK dividers for every rate in davinci_mcasp_dai_rates and
+	 * slot width, built for the sysclk, fs ratio, slot count and AHCLK
+	 * source they are valid for.
+	 */
+	struct mutex clkdiv_lock;
+	bool	clkdiv_valid;
+	unsigned int clkdiv_sysclk;
+	unsigned int clkdiv_fs_ratio;
+	int	clkdiv_slots;
+	bool	clkdiv_ahclk;
+	struct davinci_mcasp_clkdiv clkdiv[DAVINCI_MCASP_NUM_RATES][MCASP_CLKDIV_WIDTHS];
+
+	/* TX clock keep-alive between playback streams */
+	bool	tx_released;	/* TX state machine ran, worth keeping alive */
+	u32	keepalive_ms;
+	bool	keepalive_active;
+	unsigned int keepalive_rate;
+	snd_pcm_format_t keepalive_format;
+	unsigned int keepalive_channels;
+	spinlock_t keepalive_lock;
+	struct delayed_work keepalive_work;
+
+	/* Linked TX start, NULL for a McASP on its own */
+	struct davinci_mcasp_group *group;
+	int	group_index;
+	bool	clk_follower;	/* clocked from a group leader's pins */
 };
 
+/*
+ * All register access goes through a cached regmap: configuration
+ * registers are served from the cache and read-modify-write cycles that
+ * do not change the value never reach the bus.
+ */
 static inline void mcasp_set_bits(struct davinci_mcasp *mcasp, u32 offset,
 				  u32 val)
 {
-	void __iomem *reg = mcasp->base + offset;
-	__raw_writel(__raw_readl(reg) | val, reg);
+	regmap_update_bits(mcasp->regmap, offset, val, val);
 }
 
 static inline void mcasp_clr_bits(struct davinci_mcasp *mcasp, u32 offset,
 				  u32 val)
 {
-	void __iomem *reg = mcasp->base + offset;
-	__raw_writel((__raw_readl(reg) & ~(val)), reg);
+	regmap_update_bits(mcasp->regmap, offset, val, 0);
 }
 
 static inline void mcasp_mod_bits(struct davinci_mcasp *mcasp, u32 offset,
 				  u32 val, u32 mask)
 {
-	void __iomem *reg = mcasp->base + offset;
-	__raw_writel((__raw_readl(reg) & ~mask) | val, reg);
+	regmap_update_bits(mcasp->regmap, offset, mask, val);
 }
 
 static inline void mcasp_set_reg(struct davinci_mcasp *mcasp, u32 offset,
 				 u32 val)
 {
-	__raw_writel(val, mcasp->base + offset);
+	regmap_write(mcasp->regmap, offset, val);
 }
 
 static inline u32 mcasp_get_reg(struct davinci_mcasp *mcasp, u32 offset)
 {
-	return (u32)__raw_readl(mcasp->base + offset);
+	unsigned int val = 0;
+
+	regmap_read(mcasp->regmap, offset, &val);
+
+	return val;
+}
+
+static void davinci_mcasp_stats_reset(struct davinci_mcasp *mcasp)
+{
+	int stream, i;
+
+	for_each_pcm_streams(stream) {
+		struct davinci_mcasp_stats *stats = &mcasp->stats[stream];
+
+		atomic_set(&stats->xruns, 0);
+		atomic_set(&stats->triggers, 0);
+		atomic_set(&stats->fifo_samples, 0);
+		atomic_set(&stats->fifo_min, INT_MAX);
+		atomic_set(&stats->fifo_max, 0);
+		for (i = 0; i < MCASP_FIFO_HIST_BUCKETS; i++)
+			atomic_set(&stats->fifo_hist[i], 0);
+		WRITE_ONCE(stats->start_wait_ns, 0);
+		WRITE_ONCE(stats->start_wait_max_ns, 0);
+		atomic_set(&stats->start_timeouts, 0);
+	}
+}
+
+/* Called with the PCM stream lock held, so there is one writer per stream */
+static void davinci_mcasp_stats_fifo(struct davinci_mcasp_stats *stats,
+				     u32 level)
+{
+	int bucket = level * MCASP_FIFO_HIST_BUCKETS /
+		     (MCASP_MAX_AFIFO_DEPTH + 1);
+
+	if (bucket >= MCASP_FIFO_HIST_BUCKETS)
+		bucket = MCASP_FIFO_HIST_BUCKETS - 1;
+
+	atomic_inc(&stats->fifo_samples);
+	atomic_inc(&stats->fifo_hist[bucket]);
+	if ((int)level < atomic_read(&stats->fifo_min))
+		atomic_set(&stats->fifo_min, level);
+	if ((int)level > atomic_read(&stats->fifo_max))
+		atomic_set(&stats->fifo_max, level);
 }
 
 static void mcasp_set_ctl_reg(struct davinci_mcasp *mcasp, u32 ctl_reg, u32 val)
@@ -249,11 +408,17 @@ static void mcasp_start_rx(struct davinci_mcasp *mcasp)
 	/* enable receive IRQs */
 	mcasp_set_bits(mcasp, DAVINCI_MCASP_EVTCTLR_REG,
 		       mcasp->irq_request[SNDRV_PCM_STREAM_CAPTURE]);
+
+	trace_mcasp_start_rx(mcasp->dev, mcasp->streams);
 }
 
-static void mcasp_start_tx(struct davinci_mcasp *mcasp)
+static int mcasp_start_tx(struct davinci_mcasp *mcasp)
 {
-	u32 cnt;
+	struct davinci_mcasp_stats *stats =
+				&mcasp->stats[SNDRV_PCM_STREAM_PLAYBACK];
+	ktime_t start;
+	u32 stat, wait;
+	int ret;
 
 	if (mcasp->txnumevt) {	/* enable FIFO */
 		u32 reg = mcasp->fifo_base + MCASP_WFIFOCTL_OFFSET;
@@ -271,14 +436,35 @@ static void mcasp_start_tx(struct davinci_mcasp *mcasp)
 	mcasp_set_reg(mcasp, DAVINCI_MCASP_TXSTAT_REG, 0xFFFFFFFF);
 	mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_GBLCTLX_REG, TXSERCLR);
 
-	/* wait for XDATA to be cleared */
-	cnt = 0;
-	while ((mcasp_get_reg(mcasp, DAVINCI_MCASP_TXSTAT_REG) & XRDATA) &&
-	       (cnt < 100000))
-		cnt++;
+	/*
+	 * Wait for XDATA to be cleared. We are called with interrupts off, so
+	 * bound the wait and let the trigger fail instead of stalling the CPU.
+	 */
+	start = ktime_get();
+	ret = read_poll_timeout_atomic(mcasp_get_reg, stat, !(stat & XRDATA),
+				       0, MCASP_XRDATA_TIMEOUT_US, false,
+				       mcasp, DAVINCI_MCASP_TXSTAT_REG);
+	wait = ktime_to_ns(ktime_sub(ktime_get(), start));
+	WRITE_ONCE(stats->start_wait_ns, wait);
+	if (wait > stats->start_wait_max_ns)
+		WRITE_ONCE(stats->start_wait_max_ns, wait);
+	if (ret) {
+		atomic_inc(&stats->start_timeouts);
+		dev_err_ratelimited(mcasp->dev,
+				    "TX serializers not ready after %u us\n",
+				    MCASP_XRDATA_TIMEOUT_US);
+		return ret;
+	}
 
 	mcasp_set_axr_pdir(mcasp, true);
 
+	return 0;
+}
+
+static void mcasp_release_tx(struct davinci_mcasp *mcasp)
+{
+	mcasp->tx_released = true;
+
 	/* Release TX state machine */
 	mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_GBLCTLX_REG, TXSMRST);
 	/* Release Frame Sync generator */
@@ -287,16 +473,132 @@ static void mcasp_start_tx(struct davinci_mcasp *mcasp)
 	/* enable transmit IRQs */
 	mcasp_set_bits(mcasp, DAVINCI_MCASP_EVTCTLX_REG,
 		       mcasp->irq_request[SNDRV_PCM_STREAM_PLAYBACK]);
+
+	trace_mcasp_start_tx(mcasp->dev, mcasp->streams);
 }
 
-static void davinci_mcasp_start(struct davinci_mcasp *mcasp, int stream)
+/*
+ * Members whose playback stream is linked with @substream by
+ * snd_pcm_link(), @substream's own included. Called with the group lock.
+ */
+static unsigned long mcasp_group_linked(struct davinci_mcasp_group *group,
+					struct snd_pcm_substream *substream)
 {
-	mcasp->streams++;
+	struct snd_pcm_substream *s;
+	unsigned long linked = 0;
+	int i;
 
-	if (stream == SNDRV_PCM_STREAM_PLAYBACK)
-		mcasp_start_tx(mcasp);
-	else
-		mcasp_start_rx(mcasp);
+	for (i = 0; i < group->num_members; i++) {
+		if (!group->members[i])
+			continue;
+		s = group->members[i]->substreams[SNDRV_PCM_STREAM_PLAYBACK];
+		if (s && (s == substream ||
+			  (snd_pcm_stream_linked(substream) &&
+			   s->group == substream->group)))
+			linked |= BIT(i);
+	}
+
+	return linked;
+}
+
+/*
+ * Release the armed members once all members linked with them are armed
+ * too, or right away with @force. Called with the group lock.
+ */
+static void mcasp_group_try_release(struct davinci_mcasp_group *group,
+				    bool force)
+{
+	struct snd_pcm_substream *substream;
+	unsigned long need = 0;
+	int i;
+
+	if (!group->armed)
+		return;
+
+	for (i = 0; i < group->num_members; i++) {
+		if (!(group->armed & BIT(i)))
+			continue;
+		substream = group->members[i]->substreams[SNDRV_PCM_STREAM_PLAYBACK];
+		if (substream)
+			need |= mcasp_group_linked(group, substream);
+	}
+	need &= ~group->running;
+
+	if (!force && (need & ~group->armed))
+		return;
+
+	/* Followers first, the leader's frame sync starts them all */
+	for (i = group->num_members - 1; i >= 0; i--)
+		if (group->armed & BIT(i))
+			mcasp_release_tx(group->members[i]);
+
+	group->running |= group->armed;
+	group->armed = 0;
+	timer_delete(&group->timeout);
+}
+
+/* A linked stream that never follows does not hold back the others */
+static void mcasp_group_timeout(struct timer_list *t)
+{
+	struct davinci_mcasp_group *group =
+		container_of(t, struct davinci_mcasp_group, timeout);
+	unsigned long flags;
+
+	spin_lock_irqsave(&mcasp_group_lock, flags);
+	if (group->armed) {
+		dev_warn_ratelimited(group->members[__ffs(group->armed)]->dev,
+				     "linked TX start timed out\n");
+		mcasp_group_try_release(group, true);
+	}
+	spin_unlock_irqrestore(&mcasp_group_lock, flags);
+}
+
+/*
+ * Release the TX side once every member whose playback stream is linked
+ * with this one is ready to. Linked streams are triggered back to back,
+ * the last of them releases all members with interrupts off, followers
+ * first, so the leader's first frame sync starts all of them. A stream
+ * not linked to others, or starting while they already run, is released
+ * right away.
+ */
+static void mcasp_group_release_tx(struct davinci_mcasp *mcasp)
+{
+	struct davinci_mcasp_group *group;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mcasp_group_lock, flags);
+	group = READ_ONCE(mcasp->group);
+	if (!group) {
+		mcasp_release_tx(mcasp);
+		goto out;
+	}
+
+	group->armed |= BIT(mcasp->group_index);
+	mcasp_group_try_release(group, false);
+	if (group->armed)
+		mod_timer(&group->timeout, jiffies +
+			  msecs_to_jiffies(MCASP_GROUP_TIMEOUT_MS));
+out:
+	spin_unlock_irqrestore(&mcasp_group_lock, flags);
+}
+
+/* A stopping or closing member may be the one the others wait for */
+static void mcasp_group_stop_tx(struct davinci_mcasp *mcasp, bool close)
+{
+	struct davinci_mcasp_group *group;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mcasp_group_lock, flags);
+	if (close)
+		mcasp->substreams[SNDRV_PCM_STREAM_PLAYBACK] = NULL;
+
+	group = READ_ONCE(mcasp->group);
+	if (group) {
+		group->armed &= ~BIT(mcasp->group_index);
+		group->running &= ~BIT(mcasp->group_index);
+		mcasp_group_try_release(group, false);
+	}
+	spin_unlock_irqrestore(&mcasp_group_lock, flags);
 }
 
 static void mcasp_stop_rx(struct davinci_mcasp *mcasp)
@@ -322,9 +624,11 @@ static void mcasp_stop_rx(struct davinci_mcasp *mcasp)
 
 		mcasp_clr_bits(mcasp, reg, FIFO_ENABLE);
 	}
+
+	trace_mcasp_stop_rx(mcasp->dev, mcasp->streams);
 }
 
-static void mcasp_stop_tx(struct davinci_mcasp *mcasp)
+static void mcasp_stop_tx(struct davinci_mcasp *mcasp, bool keepalive)
 {
 	u32 val = 0;
 
@@ -336,7 +640,7 @@ static void mcasp_stop_tx(struct davinci_mcasp *mcasp)
 	 * In synchronous mode keep TX clocks running if the capture stream is
 	 * still running.
 	 */
-	if (mcasp_is_synchronous(mcasp) && mcasp->streams)
+	if ((mcasp_is_synchronous(mcasp) && mcasp->streams) || keepalive)
 		val =  TXHCLKRST | TXCLKRST | TXFSRST;
 	else
 		mcasp_set_clk_pdir(mcasp, false);
@@ -351,17 +655,160 @@ static void mcasp_stop_tx(struct davinci_mcasp *mcasp)
 		mcasp_clr_bits(mcasp, reg, FIFO_ENABLE);
 	}
 
-	mcasp_set_axr_pdir(mcasp, false);
+	/*
+	 * With the serializers in reset the data pins stay outputs at their
+	 * DISMOD level, so the DAC sees running clocks with silent data.
+	 */
+	if (!keepalive)
+		mcasp_set_axr_pdir(mcasp, false);
+
+	trace_mcasp_stop_tx(mcasp->dev, mcasp->streams);
 }
 
-static void davinci_mcasp_stop(struct davinci_mcasp *mcasp, int stream)
+/*
+ * Kept alive frame sync would let a linked leader start its state machine
+ * in the middle of a frame, so groups always stop their clocks.
+ */
+static bool davinci_mcasp_can_keepalive(struct davinci_mcasp *mcasp)
 {
+	return mcasp->keepalive_ms && mcasp->bclk_master &&
+	       mcasp->op_mode != DAVINCI_MCASP_DIT_MODE && !mcasp->group;
+}
+
+static void davinci_mcasp_stop(struct davinci_mcasp *mcasp, int stream,
+			       bool keepalive)
+{
+	struct snd_pcm_substream *substream = mcasp->substreams[stream];
+	unsigned long flags;
+
 	mcasp->streams--;
 
-	if (stream == SNDRV_PCM_STREAM_PLAYBACK)
-		mcasp_stop_tx(mcasp);
-	else
+	if (stream != SNDRV_PCM_STREAM_PLAYBACK) {
 		mcasp_stop_rx(mcasp);
+		return;
+	}
+
+	mcasp_group_stop_tx(mcasp, false);
+
+	keepalive = keepalive && substream && mcasp->tx_released &&
+		    davinci_mcasp_can_keepalive(mcasp);
+	mcasp->tx_released = false;
+	mcasp_stop_tx(mcasp, keepalive);
+	if (!keepalive)
+		return;
+
+	/* Hold the device active until the keep-alive window expires */
+	pm_runtime_get_noresume(mcasp->dev);
+
+	spin_lock_irqsave(&mcasp->keepalive_lock, flags);
+	mcasp->keepalive_active = true;
+	mcasp->keepalive_rate = substream->runtime->rate;
+	mcasp->keepalive_format = substream->runtime->format;
+	mcasp->keepalive_channels = substream->runtime->channels;
+	spin_unlock_irqrestore(&mcasp->keepalive_lock, flags);
+
+	schedule_delayed_work(&mcasp->keepalive_work,
+			      msecs_to_jiffies(mcasp->keepalive_ms));
+}
+
+/* Stop the clocks left running by a keep-alive stop, if still pending */
+static void davinci_mcasp_keepalive_expire(struct davinci_mcasp *mcasp)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&mcasp->keepalive_lock, flags);
+	if (!mcasp->keepalive_active) {
+		spin_unlock_irqrestore(&mcasp->keepalive_lock, flags);
+		return;
+	}
+	mcasp->keepalive_active = false;
+
+	/* Same as mcasp_stop_tx() without keep-alive */
+	if (!(mcasp_is_synchronous(mcasp) && mcasp->streams)) {
+		mcasp_set_clk_pdir(mcasp, false);
+		mcasp_set_reg(mcasp, DAVINCI_MCASP_GBLCTLX_REG, 0);
+	}
+	mcasp_set_axr_pdir(mcasp, false);
+	spin_unlock_irqrestore(&mcasp->keepalive_lock, flags);
+
+	pm_runtime_put(mcasp->dev);
+}
+
+static void davinci_mcasp_keepalive_work(struct work_struct *work)
+{
+	struct davinci_mcasp *mcasp = container_of(to_delayed_work(work),
+						   struct davinci_mcasp,
+						   keepalive_work);
+
+	davinci_mcasp_keepalive_expire(mcasp);
+}
+
+/*
+ * The clock setup is about to change: the running clocks can not be
+ * reused by the next stream, stop them now.
+ */
+static void davinci_mcasp_keepalive_release(struct davinci_mcasp *mcasp)
+{
+	if (!READ_ONCE(mcasp->keepalive_active))
+		return;
+
+	cancel_delayed_work_sync(&mcasp->keepalive_work);
+	davinci_mcasp_keepalive_expire(mcasp);
+}
+
+static int davinci_mcasp_start(struct davinci_mcasp *mcasp, int stream)
+{
+	unsigned long flags;
+	bool kept_alive;
+	int ret;
+
+	if (stream == SNDRV_PCM_STREAM_PLAYBACK) {
+		/*
+		 * The clocks are still running from the previous stream; take
+		 * over the keep-alive reference instead of letting the work
+		 * stop them.
+		 */
+		spin_lock_irqsave(&mcasp->keepalive_lock, flags);
+		kept_alive = mcasp->keepalive_active;
+		mcasp->keepalive_active = false;
+		spin_unlock_irqrestore(&mcasp->keepalive_lock, flags);
+
+		if (kept_alive) {
+			cancel_delayed_work(&mcasp->keepalive_work);
+			pm_runtime_put_noidle(mcasp->dev);
+		}
+	}
+
+	atomic_inc(&mcasp->stats[stream].triggers);
+
+	if (stream != SNDRV_PCM_STREAM_PLAYBACK) {
+		/*
+		 * In synchronous mode RX runs on the TX clocks: count the
+		 * stream and start them under the keep-alive lock, so that an
+		 * expiring keep-alive does not stop them underneath.
+		 */
+		spin_lock_irqsave(&mcasp->keepalive_lock, flags);
+		mcasp->streams++;
+		mcasp_start_rx(mcasp);
+		spin_unlock_irqrestore(&mcasp->keepalive_lock, flags);
+		return 0;
+	}
+
+	mcasp->streams++;
+
+	ret = mcasp_start_tx(mcasp);
+	if (ret) {
+		/*
+		 * Put the half started TX side back into reset; the STOP
+		 * trigger of the core's rollback does the accounting.
+		 */
+		mcasp_stop_tx(mcasp, false);
+		return ret;
+	}
+
+	mcasp_group_release_tx(mcasp);
+
+	return 0;
 }
 
 static irqreturn_t davinci_mcasp_tx_irq_handler(int irq, void *data)
@@ -374,7 +821,9 @@ static irqreturn_t davinci_mcasp_tx_irq_handler(int irq, void *data)
 
 	stat = mcasp_get_reg(mcasp, DAVINCI_MCASP_TXSTAT_REG);
 	if (stat & XUNDRN & irq_mask) {
-		dev_warn(mcasp->dev, "Transmit buffer underflow\n");
+		trace_mcasp_xrun(mcasp->dev, SNDRV_PCM_STREAM_PLAYBACK, stat);
+		atomic_inc(&mcasp->stats[SNDRV_PCM_STREAM_PLAYBACK].xruns);
+		dev_warn_ratelimited(mcasp->dev, "Transmit buffer underflow\n");
 		handled_mask |= XUNDRN;
 
 		substream = mcasp->substreams[SNDRV_PCM_STREAM_PLAYBACK];
@@ -383,8 +832,9 @@ static irqreturn_t davinci_mcasp_tx_irq_handler(int irq, void *data)
 	}
 
 	if (!handled_mask)
-		dev_warn(mcasp->dev, "unhandled tx event. txstat: 0x%08x\n",
-			 stat);
+		dev_warn_ratelimited(mcasp->dev,
+				     "unhandled tx event. txstat: 0x%08x\n",
+				     stat);
 
 	if (stat & XRERR)
 		handled_mask |= XRERR;
@@ -405,7 +855,9 @@ static irqreturn_t davinci_mcasp_rx_irq_handler(int irq, void *data)
 
 	stat = mcasp_get_reg(mcasp, DAVINCI_MCASP_RXSTAT_REG);
 	if (stat & ROVRN & irq_mask) {
-		dev_warn(mcasp->dev, "Receive buffer overflow\n");
+		trace_mcasp_xrun(mcasp->dev, SNDRV_PCM_STREAM_CAPTURE, stat);
+		atomic_inc(&mcasp->stats[SNDRV_PCM_STREAM_CAPTURE].xruns);
+		dev_warn_ratelimited(mcasp->dev, "Receive buffer overflow\n");
 		handled_mask |= ROVRN;
 
 		substream = mcasp->substreams[SNDRV_PCM_STREAM_CAPTURE];
@@ -414,8 +866,9 @@ static irqreturn_t davinci_mcasp_rx_irq_handler(int irq, void *data)
 	}
 
 	if (!handled_mask)
-		dev_warn(mcasp->dev, "unhandled rx event. rxstat: 0x%08x\n",
-			 stat);
+		dev_warn_ratelimited(mcasp->dev,
+				     "unhandled rx event. rxstat: 0x%08x\n",
+				     stat);
 
 	if (stat & XRERR)
 		handled_mask |= XRERR;
@@ -452,6 +905,17 @@ static int davinci_mcasp_set_dai_fmt(struct snd_soc_dai *cpu_dai,
 	if (!fmt)
 		return 0;
 
+	/* A group follower's ACLKX/AFSX are driven by the leader */
+	if (READ_ONCE(mcasp->clk_follower) &&
+	    (fmt & SND_SOC_DAIFMT_CLOCK_PROVIDER_MASK) != SND_SOC_DAIFMT_BC_FC) {
+		dev_dbg(mcasp->dev, "linked McASP, clock consumer only\n");
+		fmt = (fmt & ~SND_SOC_DAIFMT_CLOCK_PROVIDER_MASK) |
+		      SND_SOC_DAIFMT_BC_FC;
+	}
+
+	if (fmt != mcasp->dai_fmt)
+		davinci_mcasp_keepalive_release(mcasp);
+
 	pm_runtime_get_sync(mcasp->dev);
 	switch (fmt & SND_SOC_DAIFMT_FORMAT_MASK) {
 	case SND_SOC_DAIFMT_DSP_A:
@@ -611,9 +1075,32 @@ out:
 	return ret;
 }
 
+static bool davinci_mcasp_clkdiv_changes(struct davinci_mcasp *mcasp,
+					 int div_id, int div)
+{
+	u32 reg;
+
+	switch (div_id) {
+	case MCASP_CLKDIV_AUXCLK:
+		reg = mcasp_get_reg(mcasp, DAVINCI_MCASP_AHCLKXCTL_REG);
+		return (reg & AHCLKXDIV_MASK) != AHCLKXDIV(div - 1);
+	case MCASP_CLKDIV_BCLK:
+		reg = mcasp_get_reg(mcasp, DAVINCI_MCASP_ACLKXCTL_REG);
+		return (reg & ACLKXDIV_MASK) != ACLKXDIV(div - 1);
+	case MCASP_CLKDIV_BCLK_FS_RATIO:
+		return div / mcasp->tdm_slots != mcasp->slot_width;
+	default:
+		return false;
+	}
+}
+
 static int __davinci_mcasp_set_clkdiv(struct davinci_mcasp *mcasp, int div_id,
 				      int div, bool explicit)
 {
+	if (READ_ONCE(mcasp->keepalive_active) &&
+	    davinci_mcasp_clkdiv_changes(mcasp, div_id, div))
+		davinci_mcasp_keepalive_release(mcasp);
+
 	pm_runtime_get_sync(mcasp->dev);
 	switch (div_id) {
 	case MCASP_CLKDIV_AUXCLK:			/* MCLK divider */
@@ -663,6 +1150,10 @@ static int davinci_mcasp_set_clkdiv(struct snd_soc_dai *dai, int div_id,
 {
 	struct davinci_mcasp *mcasp = snd_soc_dai_get_drvdata(dai);
 
+	/* The leader divides the clocks of the whole group */
+	if (READ_ONCE(mcasp->clk_follower))
+		return -ENOTSUPP;
+
 	return __davinci_mcasp_set_clkdiv(mcasp, div_id, div, 1);
 }
 
@@ -671,6 +1162,12 @@ static int davinci_mcasp_set_sysclk(struct snd_soc_dai *dai, int clk_id,
 {
 	struct davinci_mcasp *mcasp = snd_soc_dai_get_drvdata(dai);
 
+	if (READ_ONCE(mcasp->clk_follower))
+		return -ENOTSUPP;
+
+	if (freq != mcasp->sysclk_freq)
+		davinci_mcasp_keepalive_release(mcasp);
+
 	pm_runtime_get_sync(mcasp->dev);
 
 	if (dir == SND_SOC_CLOCK_IN) {
@@ -789,6 +1286,35 @@ static int davinci_mcasp_set_tdm_slot(struct snd_soc_dai *dai,
 	return davinci_mcasp_set_ch_constraints(mcasp);
 }
 
+/*
+ * tx_slot[] lists the TX data lines, as positions among the TX serializers
+ * of serial-dir, that carry the stream. The McASP services serializers in
+ * pin order, so the list has to be ascending. An empty list selects the
+ * first TX serializers again.
+ */
+static int davinci_mcasp_set_channel_map(struct snd_soc_dai *dai,
+					 unsigned int tx_num,
+					 const unsigned int *tx_slot,
+					 unsigned int rx_num,
+					 const unsigned int *rx_slot)
+{
+	struct davinci_mcasp *mcasp = snd_soc_dai_get_drvdata(dai);
+	u32 lines = 0;
+	int i;
+
+	for (i = 0; i < tx_num; i++) {
+		if (tx_slot[i] >= 32 || (i && tx_slot[i] <= tx_slot[i - 1])) {
+			dev_err(mcasp->dev, "Bad TX data line map\n");
+			return -EINVAL;
+		}
+		lines |= BIT(tx_slot[i]);
+	}
+
+	mcasp->tx_lines = lines;
+
+	return 0;
+}
+
 static int davinci_config_channel_size(struct davinci_mcasp *mcasp,
 				       int sample_width)
 {
@@ -854,13 +1380,30 @@ static int davinci_config_channel_size(struct davinci_mcasp *mcasp,
 	return 0;
 }
 
+static int mcasp_numevt_target(struct davinci_mcasp *mcasp, int numevt,
+			       int rate, int channels)
+{
+	switch (READ_ONCE(mcasp->numevt_policy)) {
+	case MCASP_NUMEVT_MIN_LATENCY:
+		return 1;
+	case MCASP_NUMEVT_MIN_DMA_EVENTS:
+		return MCASP_MAX_AFIFO_DEPTH;
+	case MCASP_NUMEVT_AUTO:
+		return DIV_ROUND_UP(rate * channels, MCASP_AUTO_DMA_EVENT_RATE);
+	default:
+		return numevt;
+	}
+}
+
 static int mcasp_common_hw_param(struct davinci_mcasp *mcasp, int stream,
-				 int period_words, int channels, bool dsd_mode)
+				 int period_words, int channels, int rate,
+				 bool dsd_mode)
 {
 	struct snd_dmaengine_dai_dma_data *dma_data = &mcasp->dma_data[stream];
 	int i;
 	u8 tx_ser = 0;
 	u8 rx_ser = 0;
+	u8 tx_line = 0;
 	u8 slots = dsd_mode ? 1 : mcasp->tdm_slots;
 	u8 max_active_serializers, max_rx_serializers, max_tx_serializers;
 	int active_serializers, numevt;
@@ -894,7 +1437,8 @@ static int mcasp_common_hw_param(struct davinci_mcasp *mcasp, int stream,
 		mcasp_set_bits(mcasp, DAVINCI_MCASP_XRSRCTL_REG(i),
 			       mcasp->serial_dir[i]);
 		if (mcasp->serial_dir[i] == TX_MODE &&
-					tx_ser < max_tx_serializers) {
+		    tx_ser < max_tx_serializers &&
+		    (!mcasp->tx_lines || mcasp->tx_lines & BIT(tx_line++))) {
 			mcasp_mod_bits(mcasp, DAVINCI_MCASP_XRSRCTL_REG(i),
 				       mcasp->dismod, DISMOD_MASK);
 			set_bit(PIN_BIT_AXR(i), &mcasp->pdir);
@@ -935,6 +1479,8 @@ static int mcasp_common_hw_param(struct davinci_mcasp *mcasp, int stream,
 
 	/* AFIFO is not in use */
 	if (!numevt) {
+		mcasp->cur_numevt[stream] = 0;
+
 		/* Configure the burst size for platform drivers */
 		if (active_serializers > 1) {
 			/*
@@ -963,6 +1509,8 @@ static int mcasp_common_hw_param(struct davinci_mcasp *mcasp, int stream,
 	 * The number of words for numevt need to be in steps of active
 	 * serializers.
 	 */
+	numevt = mcasp_numevt_target(mcasp, numevt, rate, channels);
+	numevt = clamp(numevt, active_serializers, MCASP_MAX_AFIFO_DEPTH);
 	numevt = (numevt / active_serializers) * active_serializers;
 
 	while (period_words % numevt && numevt > 0)
@@ -972,6 +1520,7 @@ static int mcasp_common_hw_param(struct davinci_mcasp *mcasp, int stream,
 
 	mcasp_mod_bits(mcasp, reg, active_serializers, NUMDMA_MASK);
 	mcasp_mod_bits(mcasp, reg, NUMEVT(numevt), NUMEVT_MASK);
+	mcasp->cur_numevt[stream] = numevt;
 
 	/* Configure the burst size for platform drivers */
 	if (numevt == 1)
@@ -980,6 +1529,8 @@ static int mcasp_common_hw_param(struct davinci_mcasp *mcasp, int stream,
 
 out:
 	mcasp->active_serializers[stream] = active_serializers;
+	trace_mcasp_dma_burst(mcasp->dev, stream, period_words,
+			      active_serializers, numevt, dma_data->maxburst);
 
 	return 0;
 }
@@ -1131,29 +1682,22 @@ static int mcasp_dit_hw_param(struct davinci_mcasp *mcasp,
 	return 0;
 }
 
-static int davinci_mcasp_calc_clk_div(struct davinci_mcasp *mcasp,
-				      unsigned int sysclk_freq,
-				      unsigned int bclk_freq, bool set)
+static int __davinci_mcasp_calc_clk_div(unsigned int sysclk_freq,
+					unsigned int bclk_freq, bool ahclk,
+					struct davinci_mcasp_clkdiv *cd)
 {
-	u32 reg = mcasp_get_reg(mcasp, DAVINCI_MCASP_AHCLKXCTL_REG);
 	int div = sysclk_freq / bclk_freq;
 	int rem = sysclk_freq % bclk_freq;
-	int error_ppm;
 	int aux_div = 1;
 
-	if (div > (ACLKXDIV_MASK + 1)) {
-		if (reg & AHCLKXE) {
-			aux_div = div / (ACLKXDIV_MASK + 1);
-			if (div % (ACLKXDIV_MASK + 1))
-				aux_div++;
-
-			sysclk_freq /= aux_div;
-			div = sysclk_freq / bclk_freq;
-			rem = sysclk_freq % bclk_freq;
-		} else if (set) {
-			dev_warn(mcasp->dev, "Too fast reference clock (%u)\n",
-				 sysclk_freq);
-		}
+	if (div > (ACLKXDIV_MASK + 1) && ahclk) {
+		aux_div = div / (ACLKXDIV_MASK + 1);
+		if (div % (ACLKXDIV_MASK + 1))
+			aux_div++;
+
+		sysclk_freq /= aux_div;
+		div = sysclk_freq / bclk_freq;
+		rem = sysclk_freq % bclk_freq;
 	}
 
 	if (rem != 0) {
@@ -1164,21 +1708,114 @@ static int davinci_mcasp_calc_clk_div(struct davinci_mcasp *mcasp,
 			rem = rem - bclk_freq;
 		}
 	}
-	error_ppm = (div*1000000 + (int)div64_long(1000000LL*rem,
-		     (int)bclk_freq)) / div - 1000000;
 
-	if (set) {
-		if (error_ppm)
-			dev_info(mcasp->dev, "Sample-rate is off by %d PPM\n",
-				 error_ppm);
+	cd->bclk_div = div;
+	cd->aux_div = aux_div;
+	cd->ahclk = ahclk;
+	cd->error_ppm = (div*1000000 + (int)div64_long(1000000LL*rem,
+			 (int)bclk_freq)) / div - 1000000;
+
+	return cd->error_ppm;
+}
+
+static void davinci_mcasp_set_clk_div(struct davinci_mcasp *mcasp,
+				      const struct davinci_mcasp_clkdiv *cd)
+{
+	if (cd->bclk_div > (ACLKXDIV_MASK + 1))
+		dev_warn(mcasp->dev, "Too fast reference clock\n");
+
+	if (cd->error_ppm)
+		dev_info(mcasp->dev, "Sample-rate is off by %d PPM\n",
+			 cd->error_ppm);
+
+	__davinci_mcasp_set_clkdiv(mcasp, MCASP_CLKDIV_BCLK, cd->bclk_div, 0);
+	if (cd->ahclk)
+		__davinci_mcasp_set_clkdiv(mcasp, MCASP_CLKDIV_AUXCLK,
+					   cd->aux_div, 0);
+}
+
+static int davinci_mcasp_calc_clk_div(struct davinci_mcasp *mcasp,
+				      unsigned int sysclk_freq,
+				      unsigned int bclk_freq, bool set)
+{
+	u32 reg = mcasp_get_reg(mcasp, DAVINCI_MCASP_AHCLKXCTL_REG);
+	struct davinci_mcasp_clkdiv cd;
+
+	__davinci_mcasp_calc_clk_div(sysclk_freq, bclk_freq, reg & AHCLKXE, &cd);
+	if (set)
+		davinci_mcasp_set_clk_div(mcasp, &cd);
 
-		__davinci_mcasp_set_clkdiv(mcasp, MCASP_CLKDIV_BCLK, div, 0);
-		if (reg & AHCLKXE)
-			__davinci_mcasp_set_clkdiv(mcasp, MCASP_CLKDIV_AUXCLK,
-						   aux_div, 0);
+	return cd.error_ppm;
+}
+
+static int davinci_mcasp_rate_index(unsigned int rate)
+{
+	int i;
+
+	for (i = 0; i < DAVINCI_MCASP_NUM_RATES; i++)
+		if (davinci_mcasp_dai_rates[i] == rate)
+			return i;
+
+	return -1;
+}
+
+/* Called with clkdiv_lock held */
+static void davinci_mcasp_clkdiv_build(struct davinci_mcasp *mcasp, bool ahclk)
+{
+	unsigned int rate, sysclk_freq;
+	int i, w;
+
+	for (i = 0; i < DAVINCI_MCASP_NUM_RATES; i++) {
+		rate = davinci_mcasp_dai_rates[i];
+		if (mcasp->auxclk_fs_ratio)
+			sysclk_freq = rate * mcasp->auxclk_fs_ratio;
+		else
+			sysclk_freq = mcasp->sysclk_freq;
+
+		for (w = 0; w < MCASP_CLKDIV_WIDTHS; w++)
+			__davinci_mcasp_calc_clk_div(sysclk_freq,
+					8 * (w + 1) * mcasp->tdm_slots * rate,
+					ahclk, &mcasp->clkdiv[i][w]);
 	}
 
-	return error_ppm;
+	mcasp->clkdiv_sysclk = mcasp->sysclk_freq;
+	mcasp->clkdiv_fs_ratio = mcasp->auxclk_fs_ratio;
+	mcasp->clkdiv_slots = mcasp->tdm_slots;
+	mcasp->clkdiv_ahclk = ahclk;
+	mcasp->clkdiv_valid = true;
+}
+
+/*
+ * Dividers for davinci_mcasp_dai_rates[rate_idx] and a slot width from the
+ * table, rebuilt first if the clock setup changed. False for anything the
+ * table does not cover; the caller calculates those directly.
+ */
+static bool davinci_mcasp_clkdiv_lookup(struct davinci_mcasp *mcasp,
+					int rate_idx, int sbits,
+					struct davinci_mcasp_clkdiv *cd)
+{
+	int w = sbits / 8 - 1;
+	bool ahclk;
+
+	if (rate_idx < 0 || sbits % 8 || w < 0 || w >= MCASP_CLKDIV_WIDTHS)
+		return false;
+
+	if (!mcasp->auxclk_fs_ratio && !mcasp->sysclk_freq)
+		return false;
+
+	ahclk = mcasp_get_reg(mcasp, DAVINCI_MCASP_AHCLKXCTL_REG) & AHCLKXE;
+
+	mutex_lock(&mcasp->clkdiv_lock);
+	if (!mcasp->clkdiv_valid ||
+	    mcasp->clkdiv_sysclk != mcasp->sysclk_freq ||
+	    mcasp->clkdiv_fs_ratio != mcasp->auxclk_fs_ratio ||
+	    mcasp->clkdiv_slots != mcasp->tdm_slots ||
+	    mcasp->clkdiv_ahclk != ahclk)
+		davinci_mcasp_clkdiv_build(mcasp, ahclk);
+	*cd = mcasp->clkdiv[rate_idx][w];
+	mutex_unlock(&mcasp->clkdiv_lock);
+
+	return true;
 }
 
 static inline u32 davinci_mcasp_tx_delay(struct davinci_mcasp *mcasp)
@@ -1203,11 +1840,20 @@ static snd_pcm_sframes_t davinci_mcasp_delay(
 {
 	struct davinci_mcasp *mcasp = snd_soc_dai_get_drvdata(cpu_dai);
 	u32 fifo_use;
+	u8 numevt;
 
-	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
 		fifo_use = davinci_mcasp_tx_delay(mcasp);
-	else
+		numevt = mcasp->txnumevt;
+	} else {
 		fifo_use = davinci_mcasp_rx_delay(mcasp);
+		numevt = mcasp->rxnumevt;
+	}
+
+	trace_mcasp_fifo_level(mcasp->dev, substream->stream, fifo_use);
+	if (numevt)
+		davinci_mcasp_stats_fifo(&mcasp->stats[substream->stream],
+					 fifo_use);
 
 	/*
 	 * Divide the used locations with the channel count to get the
@@ -1217,6 +1863,87 @@ static snd_pcm_sframes_t davinci_mcasp_delay(
 	return fifo_use / substream->runtime->channels;
 }
 
+/*
+ * Link timestamps: the DMA position (residue based where the eDMA channel
+ * supports it) is corrected by the AFIFO level, both sampled together with
+ * the system timestamp with interrupts off, so the reported audio time is
+ * the time of the sample currently on (or just taken from) the wire.
+ */
+static int davinci_mcasp_get_time_info(struct snd_pcm_substream *substream,
+			struct timespec64 *system_ts, struct timespec64 *audio_ts,
+			struct snd_pcm_audio_tstamp_config *audio_tstamp_config,
+			struct snd_pcm_audio_tstamp_report *audio_tstamp_report)
+{
+	struct snd_soc_pcm_runtime *rtd = snd_soc_substream_to_rtd(substream);
+	struct davinci_mcasp *mcasp =
+			snd_soc_dai_get_drvdata(snd_soc_rtd_to_cpu(rtd, 0));
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct dma_chan *chan = snd_dmaengine_pcm_get_chan(substream);
+	struct dma_slave_caps caps;
+	snd_pcm_uframes_t pos, base;
+	unsigned long flags;
+	u32 fifo_use, rem, granule;
+	u64 frames, sec;
+	u8 numevt;
+
+	if (audio_tstamp_config->type_requested !=
+			SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK &&
+	    audio_tstamp_config->type_requested !=
+			SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ABSOLUTE) {
+		audio_tstamp_report->actual_type =
+				SNDRV_PCM_AUDIO_TSTAMP_TYPE_DEFAULT;
+		return 0;
+	}
+
+	local_irq_save(flags);
+	snd_pcm_gettime(runtime, system_ts);
+	pos = snd_dmaengine_pcm_pointer(substream);
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
+		fifo_use = davinci_mcasp_tx_delay(mcasp);
+		numevt = mcasp->txnumevt;
+	} else {
+		fifo_use = davinci_mcasp_rx_delay(mcasp);
+		numevt = mcasp->rxnumevt;
+	}
+	local_irq_restore(flags);
+
+	/*
+	 * We are called before the core accounts for the new position, so
+	 * handle the buffer wrap the same way snd_pcm_update_hw_ptr0() does.
+	 */
+	base = runtime->hw_ptr_base;
+	if (base + pos < runtime->status->hw_ptr)
+		base += runtime->buffer_size;
+	frames = runtime->hw_ptr_wrap + base + pos;
+
+	fifo_use /= runtime->channels;
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+		frames = frames > fifo_use ? frames - fifo_use : 0;
+	else
+		frames += fifo_use;
+
+	sec = div_u64_rem(frames, runtime->rate, &rem);
+	*audio_ts = ns_to_timespec64(sec * NSEC_PER_SEC +
+			div_u64((u64)rem * NSEC_PER_SEC, runtime->rate));
+
+	/*
+	 * The position is exact to one DMA burst when the channel reports
+	 * burst residue, otherwise only the period boundary is known.
+	 */
+	if (!chan || dma_get_slave_caps(chan, &caps) ||
+	    caps.residue_granularity == DMA_RESIDUE_GRANULARITY_DESCRIPTOR)
+		granule = runtime->period_size;
+	else
+		granule = max_t(u32, numevt / runtime->channels, 1);
+
+	audio_tstamp_report->actual_type = audio_tstamp_config->type_requested;
+	audio_tstamp_report->accuracy_report = 1;
+	audio_tstamp_report->accuracy = div_u64((u64)granule * NSEC_PER_SEC,
+						runtime->rate);
+
+	return 0;
+}
+
 static int is_dsd(snd_pcm_format_t format)
 {
 	switch (format) {
@@ -1277,6 +2004,13 @@ static int davinci_mcasp_hw_params(struct snd_pcm_substream *substream,
 		return -EINVAL;
 	}
 
+	/* Kept alive clocks are only reused for identical parameters */
+	if (READ_ONCE(mcasp->keepalive_active) &&
+	    (mcasp->keepalive_rate != params_rate(params) ||
+	     mcasp->keepalive_format != params_format(params) ||
+	     mcasp->keepalive_channels != channels))
+		davinci_mcasp_keepalive_release(mcasp);
+
 	ret = davinci_mcasp_set_dai_fmt(cpu_dai, mcasp->dai_fmt);
 	if (ret)
 		return ret;
@@ -1286,6 +2020,7 @@ static int davinci_mcasp_hw_params(struct snd_pcm_substream *substream,
 	 * the machine driver, we need to calculate the ratio.
 	 */
 	if (mcasp->bclk_master && mcasp->bclk_div == 0 && mcasp->sysclk_freq) {
+		struct davinci_mcasp_clkdiv cd;
 		int slots = mcasp->tdm_slots;
 		int rate = params_rate(params);
 		int sbits = params_width(params);
@@ -1293,12 +2028,23 @@ static int davinci_mcasp_hw_params(struct snd_pcm_substream *substream,
 		if (mcasp->slot_width)
 			sbits = mcasp->slot_width;
 
-		davinci_mcasp_calc_clk_div(mcasp, mcasp->sysclk_freq,
-					   rate * sbits * slots, true);
+		if (dsd_mode)
+			slots = 1;
+
+		/* The table is built for rate * auxclk_fs_ratio as sysclk */
+		if (!mcasp->auxclk_fs_ratio && !dsd_mode &&
+		    davinci_mcasp_clkdiv_lookup(mcasp,
+						davinci_mcasp_rate_index(rate),
+						sbits, &cd))
+			davinci_mcasp_set_clk_div(mcasp, &cd);
+		else
+			davinci_mcasp_calc_clk_div(mcasp, mcasp->sysclk_freq,
+						   rate * sbits * slots, true);
 	}
 
 	ret = mcasp_common_hw_param(mcasp, substream->stream,
-				    period_size * channels, channels, dsd_mode);
+				    period_size * channels, channels,
+				    params_rate(params), dsd_mode);
 	if (ret)
 		return ret;
 
@@ -1332,12 +2078,14 @@ static int davinci_mcasp_trigger(struct snd_pcm_substream *substream,
 	case SNDRV_PCM_TRIGGER_RESUME:
 	case SNDRV_PCM_TRIGGER_START:
 	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
-		davinci_mcasp_start(mcasp, substream->stream);
+		ret = davinci_mcasp_start(mcasp, substream->stream);
 		break;
-	case SNDRV_PCM_TRIGGER_SUSPEND:
 	case SNDRV_PCM_TRIGGER_STOP:
+		davinci_mcasp_stop(mcasp, substream->stream, true);
+		break;
+	case SNDRV_PCM_TRIGGER_SUSPEND:
 	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
-		davinci_mcasp_stop(mcasp, substream->stream);
+		davinci_mcasp_stop(mcasp, substream->stream, false);
 		break;
 
 	default:
@@ -1391,11 +2139,6 @@ static int davinci_mcasp_hw_rule_format_width(struct snd_pcm_hw_params *params,
 	return snd_mask_refine(fmt, &nfmt);
 }
 
-static const unsigned int davinci_mcasp_dai_rates[] = {
-	8000, 11025, 16000, 22050, 32000, 44100, 48000, 64000,
-	88200, 96000, 176400, 192000, 352800, 384000, 705600, 768000,
-};
-
 #define DAVINCI_MAX_RATE_ERROR_PPM 1000
 
 static int davinci_mcasp_hw_rule_rate(struct snd_pcm_hw_params *params,
@@ -1406,12 +2149,17 @@ static int davinci_mcasp_hw_rule_rate(struct snd_pcm_hw_params *params,
 		hw_param_interval(params, SNDRV_PCM_HW_PARAM_RATE);
 	int sbits = params_width(params);
 	int slots = rd->mcasp->tdm_slots;
+	bool dsd = is_dsd(params_format(params));
 	struct snd_interval range;
 	int i;
 
 	if (rd->mcasp->slot_width)
 		sbits = rd->mcasp->slot_width;
 
+	/* DSD is sent in burst mode, one slot per frame */
+	if (dsd)
+		slots = 1;
+
 	snd_interval_any(&range);
 	range.empty = 1;
 
@@ -1419,6 +2167,7 @@ static int davinci_mcasp_hw_rule_rate(struct snd_pcm_hw_params *params,
 		if (snd_interval_test(ri, davinci_mcasp_dai_rates[i])) {
 			uint bclk_freq = sbits * slots *
 					 davinci_mcasp_dai_rates[i];
+			struct davinci_mcasp_clkdiv cd;
 			unsigned int sysclk_freq;
 			int ppm;
 
@@ -1428,8 +2177,12 @@ static int davinci_mcasp_hw_rule_rate(struct snd_pcm_hw_params *params,
 			else
 				sysclk_freq = rd->mcasp->sysclk_freq;
 
-			ppm = davinci_mcasp_calc_clk_div(rd->mcasp, sysclk_freq,
-							 bclk_freq, false);
+			if (!dsd &&
+			    davinci_mcasp_clkdiv_lookup(rd->mcasp, i, sbits, &cd))
+				ppm = cd.error_ppm;
+			else
+				ppm = davinci_mcasp_calc_clk_div(rd->mcasp,
+						sysclk_freq, bclk_freq, false);
 			if (abs(ppm) < DAVINCI_MAX_RATE_ERROR_PPM) {
 				if (range.empty) {
 					range.min = davinci_mcasp_dai_rates[i];
@@ -1455,6 +2208,7 @@ static int davinci_mcasp_hw_rule_format(struct snd_pcm_hw_params *params,
 	struct snd_mask *fmt = hw_param_mask(params, SNDRV_PCM_HW_PARAM_FORMAT);
 	struct snd_mask nfmt;
 	int rate = params_rate(params);
+	int rate_idx = davinci_mcasp_rate_index(rate);
 	int slots = rd->mcasp->tdm_slots;
 	int i, count = 0;
 
@@ -1463,6 +2217,8 @@ static int davinci_mcasp_hw_rule_format(struct snd_pcm_hw_params *params,
 	for (i = 0; i <= SNDRV_PCM_FORMAT_LAST; i++) {
 		if (snd_mask_test(fmt, i)) {
 			uint sbits = snd_pcm_format_width(i);
+			bool dsd = is_dsd((__force snd_pcm_format_t)i);
+			struct davinci_mcasp_clkdiv cd;
 			unsigned int sysclk_freq;
 			int ppm;
 
@@ -1475,9 +2231,14 @@ static int davinci_mcasp_hw_rule_format(struct snd_pcm_hw_params *params,
 			if (rd->mcasp->slot_width)
 				sbits = rd->mcasp->slot_width;
 
-			ppm = davinci_mcasp_calc_clk_div(rd->mcasp, sysclk_freq,
-							 sbits * slots * rate,
-							 false);
+			if (!dsd && davinci_mcasp_clkdiv_lookup(rd->mcasp,
+							rate_idx, sbits, &cd))
+				ppm = cd.error_ppm;
+			else
+				ppm = davinci_mcasp_calc_clk_div(rd->mcasp,
+						sysclk_freq,
+						sbits * (dsd ? 1 : slots) * rate,
+						false);
 			if (abs(ppm) < DAVINCI_MAX_RATE_ERROR_PPM) {
 				snd_mask_set(&nfmt, i);
 				count++;
@@ -1521,6 +2282,9 @@ static int davinci_mcasp_startup(struct snd_pcm_substream *substream,
 
 	mcasp->substreams[substream->stream] = substream;
 
+	substream->runtime->hw.info |= SNDRV_PCM_INFO_HAS_LINK_ATIME |
+				       SNDRV_PCM_INFO_HAS_LINK_ABSOLUTE_ATIME;
+
 	if (mcasp->tdm_mask[substream->stream])
 		tdm_slots = hweight32(mcasp->tdm_mask[substream->stream]);
 
@@ -1568,6 +2332,11 @@ static int davinci_mcasp_startup(struct snd_pcm_substream *substream,
 				   0, SNDRV_PCM_HW_PARAM_CHANNELS,
 				   &mcasp->chconstr[substream->stream]);
 
+	/* The DAI only states the range, the rates are discrete */
+	snd_pcm_hw_constraint_list(substream->runtime,
+				   0, SNDRV_PCM_HW_PARAM_RATE,
+				   &davinci_mcasp_rate_constraint);
+
 	if (mcasp->max_format_width) {
 		/*
 		 * Only allow formats which require same amount of bits on the
@@ -1626,7 +2395,10 @@ static void davinci_mcasp_shutdown(struct snd_pcm_substream *substream,
 {
 	struct davinci_mcasp *mcasp = snd_soc_dai_get_drvdata(cpu_dai);
 
-	mcasp->substreams[substream->stream] = NULL;
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+		mcasp_group_stop_tx(mcasp, true);
+	else
+		mcasp->substreams[substream->stream] = NULL;
 	mcasp->active_serializers[substream->stream] = 0;
 
 	if (mcasp->op_mode == DAVINCI_MCASP_DIT_MODE)
@@ -1638,6 +2410,81 @@ static void davinci_mcasp_shutdown(struct snd_pcm_substream *substream,
 	}
 }
 
+static const char * const davinci_mcasp_numevt_policy_text[] = {
+	"Default", "Min Latency", "Min DMA Events", "Auto",
+};
+
+static SOC_ENUM_SINGLE_EXT_DECL(davinci_mcasp_numevt_policy_enum,
+				davinci_mcasp_numevt_policy_text);
+
+static int davinci_mcasp_numevt_policy_get(struct snd_kcontrol *kcontrol,
+					   struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_dai *cpu_dai = snd_kcontrol_chip(kcontrol);
+	struct davinci_mcasp *mcasp = snd_soc_dai_get_drvdata(cpu_dai);
+
+	ucontrol->value.enumerated.item[0] = READ_ONCE(mcasp->numevt_policy);
+
+	return 0;
+}
+
+/* The new policy is applied on the next hw_params */
+static int davinci_mcasp_numevt_policy_put(struct snd_kcontrol *kcontrol,
+					   struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_dai *cpu_dai = snd_kcontrol_chip(kcontrol);
+	struct davinci_mcasp *mcasp = snd_soc_dai_get_drvdata(cpu_dai);
+	unsigned int policy = ucontrol->value.enumerated.item[0];
+
+	if (policy >= ARRAY_SIZE(davinci_mcasp_numevt_policy_text))
+		return -EINVAL;
+
+	if (policy == READ_ONCE(mcasp->numevt_policy))
+		return 0;
+
+	WRITE_ONCE(mcasp->numevt_policy, policy);
+
+	return 1;
+}
+
+static int davinci_mcasp_burst_info(struct snd_kcontrol *kcontrol,
+				    struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = MCASP_MAX_AFIFO_DEPTH;
+
+	return 0;
+}
+
+static int davinci_mcasp_burst_get(struct snd_kcontrol *kcontrol,
+				   struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_dai *cpu_dai = snd_kcontrol_chip(kcontrol);
+	struct davinci_mcasp *mcasp = snd_soc_dai_get_drvdata(cpu_dai);
+
+	ucontrol->value.integer.value[0] =
+			mcasp->cur_numevt[kcontrol->private_value];
+
+	return 0;
+}
+
+#define MCASP_BURST_CTL(xname, stream) \
+{	.iface = SNDRV_CTL_ELEM_IFACE_MIXER, .name = xname, \
+	.access = SNDRV_CTL_ELEM_ACCESS_READ | \
+		  SNDRV_CTL_ELEM_ACCESS_VOLATILE, \
+	.info = davinci_mcasp_burst_info, .get = davinci_mcasp_burst_get, \
+	.private_value = stream }
+
+static const struct snd_kcontrol_new davinci_mcasp_afifo_ctls[] = {
+	SOC_ENUM_EXT("AFIFO Burst Policy", davinci_mcasp_numevt_policy_enum,
+		     davinci_mcasp_numevt_policy_get,
+		     davinci_mcasp_numevt_policy_put),
+	MCASP_BURST_CTL("Playback AFIFO Burst", SNDRV_PCM_STREAM_PLAYBACK),
+	MCASP_BURST_CTL("Capture AFIFO Burst", SNDRV_PCM_STREAM_CAPTURE),
+};
+
 static int davinci_mcasp_dai_probe(struct snd_soc_dai *dai)
 {
 	struct davinci_mcasp *mcasp = snd_soc_dai_get_drvdata(dai);
@@ -1652,11 +2499,25 @@ static int davinci_mcasp_dai_probe(struct snd_soc_dai *dai)
 					 ARRAY_SIZE(davinci_mcasp_iec958_ctls));
 	}*/
 
+	if (mcasp->txnumevt || mcasp->rxnumevt)
+		snd_soc_add_dai_controls(dai, davinci_mcasp_afifo_ctls,
+					 ARRAY_SIZE(davinci_mcasp_afifo_ctls));
+
+	return 0;
+}
+
+static int davinci_mcasp_pcm_new(struct snd_soc_pcm_runtime *rtd,
+				 struct snd_soc_dai *dai)
+{
+	/* The substream ops point at rtd->ops, so this is picked up by both */
+	rtd->ops.get_time_info = davinci_mcasp_get_time_info;
+
 	return 0;
 }
 
 static const struct snd_soc_dai_ops davinci_mcasp_dai_ops = {
 	.probe		= davinci_mcasp_dai_probe,
+	.pcm_new	= davinci_mcasp_pcm_new,
 	.startup	= davinci_mcasp_startup,
 	.shutdown	= davinci_mcasp_shutdown,
 	.trigger	= davinci_mcasp_trigger,
@@ -1666,9 +2527,10 @@ static const struct snd_soc_dai_ops davinci_mcasp_dai_ops = {
 	.set_clkdiv	= davinci_mcasp_set_clkdiv,
 	.set_sysclk	= davinci_mcasp_set_sysclk,
 	.set_tdm_slot	= davinci_mcasp_set_tdm_slot,
+	.set_channel_map = davinci_mcasp_set_channel_map,
 };
 
-#define DAVINCI_MCASP_RATES	SNDRV_PCM_RATE_8000_768000
+#define DAVINCI_MCASP_RATES	SNDRV_PCM_RATE_KNOT
 
 #define DAVINCI_MCASP_PCM_FMTS (SNDRV_PCM_FMTBIT_S8 | \
 				SNDRV_PCM_FMTBIT_U8 | \
@@ -1691,6 +2553,8 @@ static struct snd_soc_dai_driver davinci_mcasp_dai[] = {
 			.stream_name = "IIS Playback",
 			.channels_min	= 1,
 			.channels_max	= 32 * 16,
+			.rate_min	= 8000,
+			.rate_max	= DAVINCI_MCASP_RATE_MAX,
 			.rates 		= DAVINCI_MCASP_RATES,
 			.formats	= DAVINCI_MCASP_PCM_FMTS,
 		},
@@ -1698,6 +2562,8 @@ static struct snd_soc_dai_driver davinci_mcasp_dai[] = {
 			.stream_name = "IIS Capture",
 			.channels_min 	= 1,
 			.channels_max	= 32 * 16,
+			.rate_min	= 8000,
+			.rate_max	= DAVINCI_MCASP_RATE_MAX,
 			.rates 		= DAVINCI_MCASP_RATES,
 			.formats	= DAVINCI_MCASP_PCM_FMTS,
 		},
@@ -1711,7 +2577,7 @@ static struct snd_soc_dai_driver davinci_mcasp_dai[] = {
 			.stream_name = "DIT Playback",
 			.channels_min	= 1,
 			.channels_max	= 384,
-			.rates		= DAVINCI_MCASP_RATES,
+			.rates		= SNDRV_PCM_RATE_8000_768000,
 			.formats	= DAVINCI_MCASP_PCM_FMTS,
 		},
 		.ops 		= &davinci_mcasp_dai_ops,
@@ -1893,6 +2759,11 @@ static int davinci_mcasp_get_config(struct davinci_mcasp *mcasp,
 	if (of_property_read_u32(np, "auxclk-fs-ratio", &val) == 0)
 		mcasp->auxclk_fs_ratio = val;
 
+	if (of_property_read_u32(np, "clock-keepalive-ms", &val) == 0)
+		mcasp->keepalive_ms = val;
+	else
+		mcasp->keepalive_ms = clock_keepalive_ms;
+
 	if (of_property_read_u32(np, "dismod", &val) == 0) {
 		if (val == 0 || val == 2 || val == 3) {
 			pdata->dismod = DISMOD_VAL(val);
@@ -1934,17 +2805,12 @@ out:
 	}
 
 	mcasp->num_serializer = pdata->num_serializer;
-#ifdef CONFIG_PM
-	mcasp->context.xrsr_regs = devm_kcalloc(&pdev->dev,
-						mcasp->num_serializer, sizeof(u32),
-						GFP_KERNEL);
-	if (!mcasp->context.xrsr_regs)
-		return -ENOMEM;
-#endif
 	mcasp->serial_dir = pdata->serial_dir;
 	mcasp->version = pdata->version;
 	mcasp->txnumevt = pdata->txnumevt;
 	mcasp->rxnumevt = pdata->rxnumevt;
+	mcasp->numevt_policy = clamp(numevt_policy, MCASP_NUMEVT_DEFAULT,
+				     MCASP_NUMEVT_AUTO);
 	mcasp->dismod = pdata->dismod;
 
 	return 0;
@@ -2180,6 +3046,291 @@ static inline int davinci_mcasp_init_gpiochip(struct davinci_mcasp *mcasp)
 }
 #endif /* CONFIG_GPIOLIB */
 
+static bool davinci_mcasp_readable_reg(struct device *dev, unsigned int reg)
+{
+	switch (reg) {
+	case DAVINCI_MCASP_PID_REG:
+	case DAVINCI_MCASP_PWREMUMGT_REG:
+	case DAVINCI_MCASP_PFUNC_REG ... DAVINCI_MCASP_PDCLR_REG:
+	case DAVINCI_MCASP_GBLCTL_REG ... DAVINCI_MCASP_TXDITCTL_REG:
+	case DAVINCI_MCASP_GBLCTLR_REG ... DAVINCI_MCASP_REVTCTL_REG:
+	case DAVINCI_MCASP_GBLCTLX_REG ... DAVINCI_MCASP_XEVTCTL_REG:
+	case DAVINCI_MCASP_DITCSRA_REG ... DAVINCI_MCASP_DITUDRB_REG + 0x14:
+	case DAVINCI_MCASP_XRSRCTL_REG(0) ... DAVINCI_MCASP_XRSRCTL_REG(15):
+	/* Either of the two AFIFO locations, depending on the IP version */
+	case DAVINCI_MCASP_V3_AFIFO_BASE ...
+	     DAVINCI_MCASP_V2_AFIFO_BASE + MCASP_RFIFOSTS_OFFSET:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool davinci_mcasp_writeable_reg(struct device *dev, unsigned int reg)
+{
+	switch (reg) {
+	case DAVINCI_MCASP_PID_REG:
+		return false;
+	default:
+		return davinci_mcasp_readable_reg(dev, reg);
+	}
+}
+
+static bool davinci_mcasp_volatile_reg(struct device *dev, unsigned int reg)
+{
+	switch (reg) {
+	case DAVINCI_MCASP_PID_REG:
+	/* GPIO mode: PDSET/PDCLR update PDOUT and read back the pins */
+	case DAVINCI_MCASP_PDOUT_REG:
+	case DAVINCI_MCASP_PDSET_REG:
+	case DAVINCI_MCASP_PDCLR_REG:
+	/* GBLCTL is shadowed by GBLCTLR/GBLCTLX and polled for status */
+	case DAVINCI_MCASP_GBLCTL_REG:
+	case DAVINCI_MCASP_GBLCTLR_REG:
+	case DAVINCI_MCASP_GBLCTLX_REG:
+	case DAVINCI_MCASP_RXSTAT_REG:
+	case DAVINCI_MCASP_RXTDMSLOT_REG:
+	case DAVINCI_MCASP_RXCLKCHK_REG:
+	case DAVINCI_MCASP_TXSTAT_REG:
+	case DAVINCI_MCASP_TXTDMSLOT_REG:
+	case DAVINCI_MCASP_TXCLKCHK_REG:
+	case DAVINCI_MCASP_V2_AFIFO_BASE + MCASP_WFIFOSTS_OFFSET:
+	case DAVINCI_MCASP_V2_AFIFO_BASE + MCASP_RFIFOSTS_OFFSET:
+	case DAVINCI_MCASP_V3_AFIFO_BASE + MCASP_WFIFOSTS_OFFSET:
+	case DAVINCI_MCASP_V3_AFIFO_BASE + MCASP_RFIFOSTS_OFFSET:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static const struct regmap_config davinci_mcasp_regmap_config = {
+	.reg_bits = 32,
+	.val_bits = 32,
+	.reg_stride = 4,
+	.max_register = DAVINCI_MCASP_V2_AFIFO_BASE + MCASP_RFIFOSTS_OFFSET,
+	.readable_reg = davinci_mcasp_readable_reg,
+	.writeable_reg = davinci_mcasp_writeable_reg,
+	.volatile_reg = davinci_mcasp_volatile_reg,
+	.cache_type = REGCACHE_MAPLE,
+	.use_relaxed_mmio = true,
+};
+
+#ifdef CONFIG_DEBUG_FS
+static int davinci_mcasp_stats_show(struct seq_file *s, void *data)
+{
+	struct davinci_mcasp *mcasp = s->private;
+	int stream, i;
+
+	for_each_pcm_streams(stream) {
+		struct davinci_mcasp_stats *stats = &mcasp->stats[stream];
+		int samples = atomic_read(&stats->fifo_samples);
+		bool tx = stream == SNDRV_PCM_STREAM_PLAYBACK;
+
+		seq_printf(s, "%s:\n", tx ? "playback" : "capture");
+		seq_printf(s, "  %-12s %d\n", tx ? "underruns:" : "overruns:",
+			   atomic_read(&stats->xruns));
+		seq_printf(s, "  %-12s %d\n", "triggers:",
+			   atomic_read(&stats->triggers));
+		seq_printf(s, "  %-12s %s\n", "policy:",
+			   davinci_mcasp_numevt_policy_text[
+					READ_ONCE(mcasp->numevt_policy)]);
+		seq_printf(s, "  %-12s %u (DT %u)\n", "numevt:",
+			   mcasp->cur_numevt[stream],
+			   tx ? mcasp->txnumevt : mcasp->rxnumevt);
+		if (tx) {
+			seq_printf(s, "  %-12s %u ns (max %u ns)\n",
+				   "start wait:", READ_ONCE(stats->start_wait_ns),
+				   READ_ONCE(stats->start_wait_max_ns));
+			seq_printf(s, "  %-12s %d\n", "start t/o:",
+				   atomic_read(&stats->start_timeouts));
+		}
+		seq_printf(s, "  %-12s %d\n", "fifo reads:", samples);
+		if (!samples)
+			continue;
+
+		seq_printf(s, "  %-12s %d\n", "fifo min:",
+			   atomic_read(&stats->fifo_min));
+		seq_printf(s, "  %-12s %d\n", "fifo max:",
+			   atomic_read(&stats->fifo_max));
+		for (i = 0; i < MCASP_FIFO_HIST_BUCKETS; i++) {
+			int lo = DIV_ROUND_UP(i * (MCASP_MAX_AFIFO_DEPTH + 1),
+					      MCASP_FIFO_HIST_BUCKETS);
+			int hi = DIV_ROUND_UP((i + 1) *
+					      (MCASP_MAX_AFIFO_DEPTH + 1),
+					      MCASP_FIFO_HIST_BUCKETS) - 1;
+
+			seq_printf(s, "  fifo %2d-%2d:  %d\n", lo, hi,
+				   atomic_read(&stats->fifo_hist[i]));
+		}
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(davinci_mcasp_stats);
+
+static ssize_t davinci_mcasp_stats_reset_write(struct file *file,
+					       const char __user *buf,
+					       size_t count, loff_t *ppos)
+{
+	struct davinci_mcasp *mcasp = file->private_data;
+
+	davinci_mcasp_stats_reset(mcasp);
+
+	return count;
+}
+
+static const struct file_operations davinci_mcasp_stats_reset_fops = {
+	.open		= simple_open,
+	.write		= davinci_mcasp_stats_reset_write,
+	.llseek		= noop_llseek,
+};
+
+static void davinci_mcasp_init_debugfs(struct davinci_mcasp *mcasp)
+{
+	mcasp->debugfs = debugfs_create_dir(dev_name(mcasp->dev), NULL);
+	debugfs_create_file("stats", 0444, mcasp->debugfs, mcasp,
+			    &davinci_mcasp_stats_fops);
+	debugfs_create_file("reset", 0200, mcasp->debugfs, mcasp,
+			    &davinci_mcasp_stats_reset_fops);
+}
+
+static void davinci_mcasp_remove_debugfs(struct davinci_mcasp *mcasp)
+{
+	debugfs_remove_recursive(mcasp->debugfs);
+}
+#else
+static inline void davinci_mcasp_init_debugfs(struct davinci_mcasp *mcasp)
+{
+}
+
+static inline void davinci_mcasp_remove_debugfs(struct davinci_mcasp *mcasp)
+{
+}
+#endif /* CONFIG_DEBUG_FS */
+
+/*
+ * "ti,linked-mcasp" on the leader lists the McASPs clocked from its
+ * ACLKX/AFSX pins. They must already be probed; the device links make
+ * the leader's runtime PM keep them powered and unbind it with them.
+ * From then on the followers are clock consumers whatever the machine
+ * driver asks for.
+ */
+static int davinci_mcasp_init_group(struct davinci_mcasp *mcasp)
+{
+	struct device_node *np = mcasp->dev->of_node;
+	struct davinci_mcasp_group *group;
+	struct davinci_mcasp *member;
+	struct platform_device *pdev;
+	struct device_node *node;
+	unsigned long flags;
+	int i, count, ret = 0;
+
+	count = of_count_phandle_with_args(np, "ti,linked-mcasp", NULL);
+	if (count <= 0)
+		return 0;
+
+	if (count >= MCASP_GROUP_MAX) {
+		dev_err(mcasp->dev, "too many linked McASPs: %d\n", count);
+		return -EINVAL;
+	}
+
+	group = kzalloc(sizeof(*group), GFP_KERNEL);
+	if (!group)
+		return -ENOMEM;
+
+	timer_setup(&group->timeout, mcasp_group_timeout, 0);
+	group->members[0] = mcasp;
+	group->num_members = 1;
+
+	for (i = 0; i < count; i++) {
+		node = of_parse_phandle(np, "ti,linked-mcasp", i);
+		if (!node) {
+			ret = -EINVAL;
+			goto err;
+		}
+
+		pdev = of_find_device_by_node(node);
+		of_node_put(node);
+		if (!pdev) {
+			ret = -EPROBE_DEFER;
+			goto err;
+		}
+
+		member = platform_get_drvdata(pdev);
+		if (!device_is_bound(&pdev->dev) || !member) {
+			ret = -EPROBE_DEFER;
+		} else if (READ_ONCE(member->group) ||
+			   member->op_mode != DAVINCI_MCASP_IIS_MODE) {
+			dev_err(mcasp->dev, "can not link %s\n",
+				dev_name(&pdev->dev));
+			ret = -EINVAL;
+		} else if (!device_link_add(mcasp->dev, &pdev->dev,
+					    DL_FLAG_PM_RUNTIME |
+					    DL_FLAG_AUTOREMOVE_CONSUMER)) {
+			ret = -EINVAL;
+		}
+		put_device(&pdev->dev);
+		if (ret)
+			goto err;
+
+		group->members[group->num_members++] = member;
+	}
+
+	spin_lock_irqsave(&mcasp_group_lock, flags);
+	for (i = 0; i < group->num_members; i++) {
+		member = group->members[i];
+		member->group_index = i;
+		/* Wired to the leader's pins for good */
+		WRITE_ONCE(member->clk_follower, i > 0);
+		WRITE_ONCE(member->group, group);
+		group->present |= BIT(i);
+	}
+	spin_unlock_irqrestore(&mcasp_group_lock, flags);
+
+	dev_info(mcasp->dev, "TX start linked with %d McASP(s)\n", count);
+
+	return 0;
+err:
+	for (i = 1; i < group->num_members; i++)
+		device_link_remove(mcasp->dev, group->members[i]->dev);
+	kfree(group);
+	return ret;
+}
+
+/*
+ * Leave the group on remove or a failed probe, the last member frees it.
+ * The leader's device links go with its unbind.
+ */
+static void davinci_mcasp_remove_group(struct davinci_mcasp *mcasp)
+{
+	struct davinci_mcasp_group *group;
+	unsigned long flags;
+	bool last;
+
+	spin_lock_irqsave(&mcasp_group_lock, flags);
+	group = mcasp->group;
+	if (!group) {
+		spin_unlock_irqrestore(&mcasp_group_lock, flags);
+		return;
+	}
+
+	group->members[mcasp->group_index] = NULL;
+	group->present &= ~BIT(mcasp->group_index);
+	group->armed &= ~BIT(mcasp->group_index);
+	group->running &= ~BIT(mcasp->group_index);
+	WRITE_ONCE(mcasp->group, NULL);
+	/* Do not leave the others waiting for this one */
+	mcasp_group_try_release(group, false);
+	last = !group->present;
+	spin_unlock_irqrestore(&mcasp_group_lock, flags);
+
+	if (last) {
+		timer_shutdown_sync(&group->timeout);
+		kfree(group);
+	}
+}
+
 static int davinci_mcasp_probe(struct platform_device *pdev)
 {
 	struct snd_dmaengine_dai_dma_data *dma_data;
@@ -2214,7 +3365,18 @@ static int davinci_mcasp_probe(struct platform_device *pdev)
 	if (IS_ERR(mcasp->base))
 		return PTR_ERR(mcasp->base);
 
+	mcasp->regmap = devm_regmap_init_mmio(&pdev->dev, mcasp->base,
+					      &davinci_mcasp_regmap_config);
+	if (IS_ERR(mcasp->regmap)) {
+		dev_err(&pdev->dev, "failed to init regmap: %ld\n",
+			PTR_ERR(mcasp->regmap));
+		return PTR_ERR(mcasp->regmap);
+	}
+
 	dev_set_drvdata(&pdev->dev, mcasp);
+	spin_lock_init(&mcasp->keepalive_lock);
+	mutex_init(&mcasp->clkdiv_lock);
+	INIT_DELAYED_WORK(&mcasp->keepalive_work, davinci_mcasp_keepalive_work);
 	pm_runtime_enable(&pdev->dev);
 
 	mcasp->dev = &pdev->dev;
@@ -2380,21 +3542,36 @@ static int davinci_mcasp_probe(struct platform_device *pdev)
 		goto err;
 	}
 
+	ret = davinci_mcasp_init_group(mcasp);
+	if (ret)
+		goto err;
+
+	davinci_mcasp_stats_reset(mcasp);
+	davinci_mcasp_init_debugfs(mcasp);
+
 no_audio:
 	ret = davinci_mcasp_init_gpiochip(mcasp);
 	if (ret) {
 		dev_err(&pdev->dev, "gpiochip registration failed: %d\n", ret);
-		goto err;
+		goto err_debugfs;
 	}
 
 	return 0;
+err_debugfs:
+	davinci_mcasp_remove_debugfs(mcasp);
 err:
+	davinci_mcasp_remove_group(mcasp);
 	pm_runtime_disable(&pdev->dev);
 	return ret;
 }
 
 static void davinci_mcasp_remove(struct platform_device *pdev)
 {
+	struct davinci_mcasp *mcasp = dev_get_drvdata(&pdev->dev);
+
+	davinci_mcasp_keepalive_release(mcasp);
+	davinci_mcasp_remove_group(mcasp);
+	davinci_mcasp_remove_debugfs(mcasp);
 	pm_runtime_disable(&pdev->dev);
 }
 
@@ -2402,25 +3579,10 @@ static void davinci_mcasp_remove(struct platform_device *pdev)
 static int davinci_mcasp_runtime_suspend(struct device *dev)
 {
 	struct davinci_mcasp *mcasp = dev_get_drvdata(dev);
-	struct davinci_mcasp_context *context = &mcasp->context;
-	u32 reg;
-	int i;
 
-	for (i = 0; i < ARRAY_SIZE(context_regs); i++)
-		context->config_regs[i] = mcasp_get_reg(mcasp, context_regs[i]);
-
-	if (mcasp->txnumevt) {
-		reg = mcasp->fifo_base + MCASP_WFIFOCTL_OFFSET;
-		context->afifo_regs[0] = mcasp_get_reg(mcasp, reg);
-	}
-	if (mcasp->rxnumevt) {
-		reg = mcasp->fifo_base + MCASP_RFIFOCTL_OFFSET;
-		context->afifo_regs[1] = mcasp_get_reg(mcasp, reg);
-	}
-
-	for (i = 0; i < mcasp->num_serializer; i++)
-		context->xrsr_regs[i] = mcasp_get_reg(mcasp,
-						DAVINCI_MCASP_XRSRCTL_REG(i));
+	/* The register file is lost, the cache holds the context */
+	regcache_cache_only(mcasp->regmap, true);
+	regcache_mark_dirty(mcasp->regmap);
 
 	return 0;
 }
@@ -2428,27 +3590,10 @@ static int davinci_mcasp_runtime_suspend(struct device *dev)
 static int davinci_mcasp_runtime_resume(struct device *dev)
 {
 	struct davinci_mcasp *mcasp = dev_get_drvdata(dev);
-	struct davinci_mcasp_context *context = &mcasp->context;
-	u32 reg;
-	int i;
-
-	for (i = 0; i < ARRAY_SIZE(context_regs); i++)
-		mcasp_set_reg(mcasp, context_regs[i], context->config_regs[i]);
 
-	if (mcasp->txnumevt) {
-		reg = mcasp->fifo_base + MCASP_WFIFOCTL_OFFSET;
-		mcasp_set_reg(mcasp, reg, context->afifo_regs[0]);
-	}
-	if (mcasp->rxnumevt) {
-		reg = mcasp->fifo_base + MCASP_RFIFOCTL_OFFSET;
-		mcasp_set_reg(mcasp, reg, context->afifo_regs[1]);
-	}
+	regcache_cache_only(mcasp->regmap, false);
 
-	for (i = 0; i < mcasp->num_serializer; i++)
-		mcasp_set_reg(mcasp, DAVINCI_MCASP_XRSRCTL_REG(i),
-			      context->xrsr_regs[i]);
-
-	return 0;
+	return regcache_sync(mcasp->regmap);
 }
 
 #endif
@@ -10,6 +10,7 @@
  */
 
 #include <linux/module.h>
+#include <linux/of.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
 #include <sound/pcm_params.h>
@@ -20,41 +21,93 @@
 
 #include "edma-pcm.h"
 
+#define EDMA_PCM_BUFFER_BYTES_MAX	(24 * 128 * 1024)
+#define EDMA_PCM_PERIODS_MAX		19 /* Limit by edma dmaengine driver */
+/* Preallocation used in lazy mode, the real buffer comes at hw_params */
+#define EDMA_PCM_LAZY_PREALLOC		PAGE_SIZE
+
+static unsigned int buffer_bytes_max = EDMA_PCM_BUFFER_BYTES_MAX;
+module_param(buffer_bytes_max, uint, 0444);
+MODULE_PARM_DESC(buffer_bytes_max, "Maximum PCM buffer size in bytes, "
+		 "unless set by the pcm-buffer-bytes-max DT property");
+
+static unsigned int periods_max = EDMA_PCM_PERIODS_MAX;
+module_param(periods_max, uint, 0444);
+MODULE_PARM_DESC(periods_max, "Maximum number of periods (2..19), "
+		 "unless set by the pcm-periods-max DT property");
+
+static unsigned int prealloc_bytes = EDMA_PCM_BUFFER_BYTES_MAX;
+module_param(prealloc_bytes, uint, 0444);
+MODULE_PARM_DESC(prealloc_bytes, "Buffer preallocated per direction at probe, "
+		 "0 allocates at hw_params instead (pcm-prealloc-bytes in DT)");
+
 static const struct snd_pcm_hardware edma_pcm_hardware = {
 	.info			= SNDRV_PCM_INFO_MMAP |
 				  SNDRV_PCM_INFO_MMAP_VALID |
 				  SNDRV_PCM_INFO_PAUSE | SNDRV_PCM_INFO_RESUME |
 				  SNDRV_PCM_INFO_NO_PERIOD_WAKEUP |
 				  SNDRV_PCM_INFO_INTERLEAVED,
-	.buffer_bytes_max	= 24 * 128 * 1024,
+	.buffer_bytes_max	= EDMA_PCM_BUFFER_BYTES_MAX,
 	.period_bytes_min	= 32,
 	.period_bytes_max	= 24 * 64 * 1024,
 	.periods_min		= 2,
-	.periods_max		= 19, /* Limit by edma dmaengine driver */
+	.periods_max		= EDMA_PCM_PERIODS_MAX,
 };
 
 static const struct snd_dmaengine_pcm_config edma_dmaengine_pcm_config = {
-	.pcm_hardware = &edma_pcm_hardware,
 	.prepare_slave_config = snd_dmaengine_pcm_prepare_slave_config,
-	.prealloc_buffer_size = 24 * 128 * 1024,
 };
 
+static u32 edma_pcm_get_u32(struct device *dev, const char *propname,
+			    u32 def)
+{
+	u32 val;
+
+	if (dev->of_node && !of_property_read_u32(dev->of_node, propname, &val))
+		return val;
+
+	return def;
+}
+
 int edma_pcm_platform_register(struct device *dev)
 {
 	struct snd_dmaengine_pcm_config *config;
-
-	if (dev->of_node)
-		return devm_snd_dmaengine_pcm_register(dev,
-						&edma_dmaengine_pcm_config, 0);
+	struct snd_pcm_hardware *hw;
+	u32 prealloc;
 
 	config = devm_kzalloc(dev, sizeof(*config), GFP_KERNEL);
-	if (!config)
+	hw = devm_kmemdup(dev, &edma_pcm_hardware, sizeof(*hw), GFP_KERNEL);
+	if (!config || !hw)
 		return -ENOMEM;
 
 	*config = edma_dmaengine_pcm_config;
 
-	config->chan_names[0] = "tx";
-	config->chan_names[1] = "rx";
+	/* Per device buffer geometry: DT first, module parameters second */
+	hw->buffer_bytes_max = edma_pcm_get_u32(dev, "pcm-buffer-bytes-max",
+						buffer_bytes_max);
+	hw->buffer_bytes_max = max_t(size_t, hw->buffer_bytes_max,
+				     hw->periods_min * hw->period_bytes_min);
+	hw->period_bytes_max = min_t(size_t, hw->period_bytes_max,
+				     hw->buffer_bytes_max / hw->periods_min);
+	hw->periods_max = clamp_t(u32, edma_pcm_get_u32(dev, "pcm-periods-max",
+							periods_max),
+				  hw->periods_min, EDMA_PCM_PERIODS_MAX);
+
+	/*
+	 * Without preallocation the managed buffer is allocated at hw_params,
+	 * sized for the stream, and released again at hw_free.
+	 */
+	prealloc = edma_pcm_get_u32(dev, "pcm-prealloc-bytes", prealloc_bytes);
+	if (!prealloc)
+		prealloc = EDMA_PCM_LAZY_PREALLOC;
+	config->prealloc_buffer_size = min_t(size_t, prealloc,
+					     hw->buffer_bytes_max);
+	config->pcm_hardware = hw;
+
+	if (!dev->of_node) {
+		config->chan_names[0] = "tx";
+		config->chan_names[1] = "rx";
+	}
 
 	return devm_snd_dmaengine_pcm_register(dev, config, 0);
 }